@@ -33,6 +33,9 @@ int lfs_testbd_createcfg(const struct lfs_config *cfg, const char *path,
     // setup testing things
     bd->persist = path;
     bd->power_cycles = bd->cfg->power_cycles;
+    bd->erasing = (lfs_block_t)-1;
+    bd->reads = 0;
+    bd->overlaps = 0;
 
     if (bd->cfg->erase_cycles) {
         if (bd->cfg->wear_buffer) {
@@ -151,6 +154,8 @@ int lfs_testbd_read(const struct lfs_config *cfg, lfs_block_t block,
     lfs_testbd_t *bd = cfg->context;
 
     // check if read is valid
+    LFS_ASSERT(bd->erasing == (lfs_block_t)-1 ||
+            (cfg->erase_reads && block != bd->erasing));
     LFS_ASSERT(off  % cfg->read_size == 0);
     LFS_ASSERT(size % cfg->read_size == 0);
     LFS_ASSERT(block < cfg->block_count);
@@ -163,11 +168,32 @@ int lfs_testbd_read(const struct lfs_config *cfg, lfs_block_t block,
     }
 
     // read
+    bd->reads += 1;
+    if (bd->erasing != (lfs_block_t)-1) {
+        bd->overlaps += 1;
+    }
     int err = lfs_testbd_rawread(cfg, block, off, buffer, size);
     LFS_TESTBD_TRACE("lfs_testbd_read -> %d", err);
     return err;
 }
 
+int lfs_testbd_readv(const struct lfs_config *cfg,
+        const struct lfs_iovec *iov, int count) {
+    LFS_TESTBD_TRACE("lfs_testbd_readv(%p, %p, %d)",
+            (void*)cfg, (const void*)iov, count);
+    for (int i = 0; i < count; i++) {
+        int err = lfs_testbd_read(cfg, iov[i].block,
+                iov[i].off, iov[i].buffer, iov[i].size);
+        if (err) {
+            LFS_TESTBD_TRACE("lfs_testbd_readv -> %d", err);
+            return err;
+        }
+    }
+
+    LFS_TESTBD_TRACE("lfs_testbd_readv -> %d", 0);
+    return 0;
+}
+
 int lfs_testbd_prog(const struct lfs_config *cfg, lfs_block_t block,
         lfs_off_t off, const void *buffer, lfs_size_t size) {
     LFS_TESTBD_TRACE("lfs_testbd_prog(%p, "
@@ -176,6 +202,7 @@ int lfs_testbd_prog(const struct lfs_config *cfg, lfs_block_t block,
     lfs_testbd_t *bd = cfg->context;
 
     // check if write is valid
+    LFS_ASSERT(bd->erasing == (lfs_block_t)-1);
     LFS_ASSERT(off  % cfg->prog_size == 0);
     LFS_ASSERT(size % cfg->prog_size == 0);
     LFS_ASSERT(block < cfg->block_count);
@@ -222,6 +249,7 @@ int lfs_testbd_erase(const struct lfs_config *cfg, lfs_block_t block) {
     lfs_testbd_t *bd = cfg->context;
 
     // check if erase is valid
+    LFS_ASSERT(bd->erasing == (lfs_block_t)-1);
     LFS_ASSERT(block < cfg->block_count);
 
     // block bad?
@@ -264,8 +292,40 @@ int lfs_testbd_erase(const struct lfs_config *cfg, lfs_block_t block) {
     return 0;
 }
 
+int lfs_testbd_erase_async(const struct lfs_config *cfg, lfs_block_t block) {
+    LFS_TESTBD_TRACE("lfs_testbd_erase_async(%p, 0x%"PRIx32")",
+            (void*)cfg, block);
+    lfs_testbd_t *bd = cfg->context;
+
+    // check if erase is valid
+    LFS_ASSERT(bd->erasing == (lfs_block_t)-1);
+    LFS_ASSERT(block < cfg->block_count);
+
+    // erase when waited on
+    bd->erasing = block;
+    LFS_TESTBD_TRACE("lfs_testbd_erase_async -> %d", 0);
+    return 0;
+}
+
+int lfs_testbd_wait(const struct lfs_config *cfg) {
+    LFS_TESTBD_TRACE("lfs_testbd_wait(%p)", (void*)cfg);
+    lfs_testbd_t *bd = cfg->context;
+    if (bd->erasing == (lfs_block_t)-1) {
+        LFS_TESTBD_TRACE("lfs_testbd_wait -> %d", 0);
+        return 0;
+    }
+
+    lfs_block_t block = bd->erasing;
+    bd->erasing = (lfs_block_t)-1;
+    int err = lfs_testbd_erase(cfg, block);
+    LFS_TESTBD_TRACE("lfs_testbd_wait -> %d", err);
+    return err;
+}
+
 int lfs_testbd_sync(const struct lfs_config *cfg) {
     LFS_TESTBD_TRACE("lfs_testbd_sync(%p)", (void*)cfg);
+    lfs_testbd_t *bd = cfg->context;
+    LFS_ASSERT(bd->erasing == (lfs_block_t)-1);
     int err = lfs_testbd_rawsync(cfg);
     LFS_TESTBD_TRACE("lfs_testbd_sync -> %d", err);
     return err;
@@ -300,3 +360,17 @@ int lfs_testbd_setwear(const struct lfs_config *cfg,
     LFS_TESTBD_TRACE("lfs_testbd_setwear -> %d", 0);
     return 0;
 }
+
+lfs_size_t lfs_testbd_getreads(const struct lfs_config *cfg) {
+    LFS_TESTBD_TRACE("lfs_testbd_getreads(%p)", (void*)cfg);
+    lfs_testbd_t *bd = cfg->context;
+    LFS_TESTBD_TRACE("lfs_testbd_getreads -> %"PRIu32, bd->reads);
+    return bd->reads;
+}
+
+lfs_size_t lfs_testbd_getoverlaps(const struct lfs_config *cfg) {
+    LFS_TESTBD_TRACE("lfs_testbd_getoverlaps(%p)", (void*)cfg);
+    lfs_testbd_t *bd = cfg->context;
+    LFS_TESTBD_TRACE("lfs_testbd_getoverlaps -> %"PRIu32, bd->overlaps);
+    return bd->overlaps;
+}
@@ -84,7 +84,10 @@ typedef struct lfs_testbd {
 
     bool persist;
     uint32_t power_cycles;
+    lfs_block_t erasing;
     lfs_testbd_wear_t *wear;
+    lfs_size_t reads;
+    lfs_size_t overlaps;
 
     const struct lfs_testbd_config *cfg;
 } lfs_testbd_t;
@@ -107,6 +110,10 @@ int lfs_testbd_destroy(const struct lfs_config *cfg);
 int lfs_testbd_read(const struct lfs_config *cfg, lfs_block_t block,
         lfs_off_t off, void *buffer, lfs_size_t size);
 
+// Read several regions in one call
+int lfs_testbd_readv(const struct lfs_config *cfg,
+        const struct lfs_iovec *iov, int count);
+
 // Program a block
 //
 // The block must have previously been erased.
@@ -119,6 +126,15 @@ int lfs_testbd_prog(const struct lfs_config *cfg, lfs_block_t block,
 // state of an erased block is undefined.
 int lfs_testbd_erase(const struct lfs_config *cfg, lfs_block_t block);
 
+// Start erasing a block
+//
+// The erase only happens when waited on, so any operation that doesn't
+// wait first sees the old contents of the block.
+int lfs_testbd_erase_async(const struct lfs_config *cfg, lfs_block_t block);
+
+// Wait for an erase started by lfs_testbd_erase_async
+int lfs_testbd_wait(const struct lfs_config *cfg);
+
 // Sync the block device
 int lfs_testbd_sync(const struct lfs_config *cfg);
 
@@ -133,6 +149,13 @@ lfs_testbd_swear_t lfs_testbd_getwear(const struct lfs_config *cfg,
 int lfs_testbd_setwear(const struct lfs_config *cfg,
         lfs_block_t block, lfs_testbd_wear_t wear);
 
+// Get the number of reads made so far, each region of a vectored read
+// counts as one
+lfs_size_t lfs_testbd_getreads(const struct lfs_config *cfg);
+
+// Get the number of reads made while an asynchronous erase was pending
+lfs_size_t lfs_testbd_getoverlaps(const struct lfs_config *cfg);
+
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -24,6 +24,252 @@ static inline void lfs_cache_zero(lfs_t *lfs, lfs_cache_t *pcache) {
     pcache->block = LFS_BLOCK_NULL;
 }
 
+// additional read caches, grouped into sets indexed by block address
+static inline struct lfs_rway *lfs_rset_get(lfs_t *lfs, lfs_block_t block) {
+    return &lfs->rset.ways[(block % lfs->rset.sets)*lfs->rset.count];
+}
+
+static const lfs_cache_t *lfs_rset_find(lfs_t *lfs,
+        lfs_block_t block, lfs_off_t off) {
+    struct lfs_rway *set = lfs_rset_get(lfs, block);
+    for (lfs_size_t i = 0; i < lfs->rset.count; i++) {
+        if (block == set[i].cache.block &&
+                off >= set[i].cache.off &&
+                off < set[i].cache.off + set[i].cache.size) {
+            lfs->rset.age += 1;
+            set[i].age = lfs->rset.age;
+            return &set[i].cache;
+        }
+    }
+
+    return NULL;
+}
+
+static void lfs_rset_push(lfs_t *lfs, const lfs_cache_t *rcache) {
+    // replace the same window if we already have it, otherwise the
+    // least-recently-used entry in the set
+    struct lfs_rway *set = lfs_rset_get(lfs, rcache->block);
+    struct lfs_rway *way = &set[0];
+    for (lfs_size_t i = 0; i < lfs->rset.count; i++) {
+        if (rcache->block == set[i].cache.block &&
+                rcache->off == set[i].cache.off) {
+            way = &set[i];
+            break;
+        }
+
+        if (set[i].age < way->age) {
+            way = &set[i];
+        }
+    }
+
+    way->cache.block = rcache->block;
+    way->cache.off = rcache->off;
+    way->cache.size = rcache->size;
+    memcpy(way->cache.buffer, rcache->buffer, rcache->size);
+    lfs->rset.age += 1;
+    way->age = lfs->rset.age;
+}
+
+#ifndef LFS_READONLY
+static void lfs_rset_drop(lfs_t *lfs, lfs_block_t block) {
+    if (!lfs->rset.ways) {
+        return;
+    }
+
+    // block is being modified, make sure we don't hold on to stale data
+    if (block == lfs->rcache.block) {
+        lfs_cache_drop(lfs, &lfs->rcache);
+    }
+
+    struct lfs_rway *set = lfs_rset_get(lfs, block);
+    for (lfs_size_t i = 0; i < lfs->rset.count; i++) {
+        if (block == set[i].cache.block) {
+            lfs_cache_drop(lfs, &set[i].cache);
+            set[i].age = 0;
+        }
+    }
+}
+
+// free blocks erased ahead of time, a block stays in the pool until it's
+// erased again or programmed
+static lfs_size_t lfs_pool_find(lfs_t *lfs, lfs_block_t block) {
+    for (lfs_size_t i = 0; i < lfs->pool.size; i++) {
+        if (lfs->pool.blocks[i] == block) {
+            return i;
+        }
+    }
+
+    return lfs->pool.size;
+}
+
+static bool lfs_pool_take(lfs_t *lfs, lfs_block_t block) {
+    lfs_size_t i = lfs_pool_find(lfs, block);
+    if (i == lfs->pool.size) {
+        return false;
+    }
+
+    lfs->pool.size -= 1;
+    lfs->pool.blocks[i] = lfs->pool.blocks[lfs->pool.size];
+    return true;
+}
+
+static void lfs_dircache_drop(lfs_t *lfs, lfs_block_t block) {
+    // open directories with their own read cache may hold this block
+    for (struct lfs_mlist *p = lfs->mlist; p; p = p->next) {
+        lfs_dir_t *dir = (lfs_dir_t*)p;
+        if (p->type == LFS_TYPE_DIR && dir->cache.buffer &&
+                block == dir->cache.block) {
+            lfs_cache_drop(lfs, &dir->cache);
+        }
+    }
+}
+#endif
+
+// metadata pair summaries
+static void lfs_mcache_reset(lfs_t *lfs) {
+    for (lfs_size_t i = 0; i < lfs->mcache.count; i++) {
+        lfs->mcache.entries[i].pair[0] = LFS_BLOCK_NULL;
+        lfs->mcache.entries[i].pair[1] = LFS_BLOCK_NULL;
+    }
+}
+
+static lfs_mdir_t *lfs_mcache_get(lfs_t *lfs, const lfs_block_t pair[2]) {
+    if (!lfs->mcache.count) {
+        return NULL;
+    }
+
+    return &lfs->mcache.entries[
+            (pair[0] ^ pair[1]) % lfs->mcache.count];
+}
+
+static void lfs_mcache_put(lfs_t *lfs, const lfs_mdir_t *dir) {
+    lfs_mdir_t *m = lfs_mcache_get(lfs, dir->pair);
+    if (m) {
+        *m = *dir;
+    }
+}
+
+#ifndef LFS_READONLY
+static void lfs_mcache_drop(lfs_t *lfs, lfs_block_t block) {
+    // the block is about to change on disk, we can't tell which pair it
+    // was part of without looking
+    for (lfs_size_t i = 0; i < lfs->mcache.count; i++) {
+        lfs_mdir_t *m = &lfs->mcache.entries[i];
+        if (m->pair[0] == block || m->pair[1] == block) {
+            m->pair[0] = LFS_BLOCK_NULL;
+            m->pair[1] = LFS_BLOCK_NULL;
+        }
+    }
+}
+#endif
+
+// checked commits in metadata blocks
+static void lfs_vcache_reset(lfs_t *lfs) {
+    for (lfs_size_t i = 0; i < lfs->vcache.count; i++) {
+        lfs->vcache.entries[i].block = LFS_BLOCK_NULL;
+    }
+}
+
+static lfs_off_t lfs_vcache_get(lfs_t *lfs, lfs_block_t block, uint32_t rev) {
+    if (!lfs->vcache.count) {
+        return 0;
+    }
+
+    const struct lfs_vblock *v = &lfs->vcache.entries[
+            block % lfs->vcache.count];
+    if (v->block != block || v->rev != rev) {
+        return 0;
+    }
+
+    return v->off;
+}
+
+static void lfs_vcache_put(lfs_t *lfs,
+        lfs_block_t block, uint32_t rev, lfs_off_t off) {
+    if (!lfs->vcache.count) {
+        return;
+    }
+
+    struct lfs_vblock *v = &lfs->vcache.entries[block % lfs->vcache.count];
+    v->block = block;
+    v->rev = rev;
+    v->off = off;
+}
+
+#ifndef LFS_READONLY
+static void lfs_vcache_drop(lfs_t *lfs, lfs_block_t block) {
+    if (!lfs->vcache.count) {
+        return;
+    }
+
+    struct lfs_vblock *v = &lfs->vcache.entries[block % lfs->vcache.count];
+    if (v->block == block) {
+        v->block = LFS_BLOCK_NULL;
+    }
+}
+#endif
+
+// would a read of this region hit one of our caches?
+static bool lfs_bd_iscached(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        lfs_block_t block, lfs_off_t off, lfs_size_t size) {
+    if (pcache && block == pcache->block &&
+            off < pcache->off + pcache->size && pcache->off < off + size) {
+        return true;
+    }
+
+    if (block == rcache->block &&
+            off < rcache->off + rcache->size && rcache->off < off + size) {
+        return true;
+    }
+
+    return rcache == &lfs->rcache && lfs->rset.ways &&
+            lfs_rset_find(lfs, block, off);
+}
+
+// the block device can't do anything else while an asynchronous erase is
+// running, wait for it before using the block device
+static int lfs_bd_wait(lfs_t *lfs) {
+    if (!lfs->erasing.busy) {
+        return 0;
+    }
+
+    lfs->erasing.busy = false;
+    int err = lfs->cfg->wait(lfs->cfg);
+    LFS_ASSERT(err <= 0);
+    if (err && err != LFS_ERR_CORRUPT) {
+        return err;
+    }
+
+    // a bad block is reported when we program it, since that's where we
+    // know how to recover from one
+    if (err) {
+        lfs->erasing.bad = lfs->erasing.block;
+    }
+    return 0;
+}
+
+// some block devices can read other blocks while erasing, only wait if
+// they can't or if we want the block being erased
+static int lfs_bd_waitread(lfs_t *lfs, lfs_block_t block) {
+    if (lfs->cfg->erase_reads && block != lfs->erasing.block) {
+        return 0;
+    }
+
+    return lfs_bd_wait(lfs);
+}
+
+// asynchronous erases don't outlive the call that started them, so shared
+// readers never find the block device busy
+static lfs_ssize_t lfs_bd_settle(lfs_t *lfs, lfs_ssize_t res) {
+    int err = lfs_bd_wait(lfs);
+    if (res < 0 || !err) {
+        return res;
+    }
+
+    return err;
+}
+
 static int lfs_bd_read(lfs_t *lfs,
         const lfs_cache_t *pcache, lfs_cache_t *rcache, lfs_size_t hint,
         lfs_block_t block, lfs_off_t off,
@@ -71,11 +317,60 @@ static int lfs_bd_read(lfs_t *lfs,
             diff = lfs_min(diff, rcache->off-off);
         }
 
+        if (rcache == &lfs->rcache && lfs->rset.ways) {
+            // is already in one of the additional read caches?
+            const lfs_cache_t *way = lfs_rset_find(lfs, block, off);
+            if (way) {
+                diff = lfs_min(diff, way->size - (off-way->off));
+                memcpy(data, &way->buffer[off-way->off], diff);
+
+                data += diff;
+                off += diff;
+                size -= diff;
+                continue;
+            }
+        }
+
         if (size >= hint && off % lfs->cfg->read_size == 0 &&
                 size >= lfs->cfg->read_size) {
             // bypass cache?
             diff = lfs_aligndown(diff, lfs->cfg->read_size);
-            int err = lfs->cfg->read(lfs->cfg, block, off, data, diff);
+            int err = lfs_bd_waitread(lfs, block);
+            if (err) {
+                return err;
+            }
+
+            lfs_size_t tail = size - diff;
+            if (lfs->cfg->readv && tail > 0 &&
+                    tail < lfs->cfg->read_size &&
+                    !lfs_bd_iscached(lfs, pcache, rcache,
+                        block, off+diff, tail)) {
+                // the unaligned tail needs the cache, load it in the
+                // same call
+                if (rcache == &lfs->rcache && lfs->rset.ways &&
+                        rcache->block < lfs->cfg->block_count) {
+                    lfs_rset_push(lfs, rcache);
+                }
+
+                rcache->block = block;
+                rcache->off = off+diff;
+                rcache->size = lfs->cfg->read_size;
+                const struct lfs_iovec iov[2] = {
+                    {block, off, data, diff},
+                    {block, rcache->off, rcache->buffer, rcache->size},
+                };
+                err = lfs->cfg->readv(lfs->cfg, iov, 2);
+                LFS_ASSERT(err <= 0);
+                if (err) {
+                    lfs_cache_drop(lfs, rcache);
+                    return err;
+                }
+
+                memcpy(data+diff, rcache->buffer, tail);
+                return 0;
+            }
+
+            err = lfs->cfg->read(lfs->cfg, block, off, data, diff);
             if (err) {
                 return err;
             }
@@ -86,6 +381,17 @@ static int lfs_bd_read(lfs_t *lfs,
             continue;
         }
 
+        int err = lfs_bd_waitread(lfs, block);
+        if (err) {
+            return err;
+        }
+
+        if (rcache == &lfs->rcache && lfs->rset.ways &&
+                rcache->block < lfs->cfg->block_count) {
+            // hold on to what we are about to evict
+            lfs_rset_push(lfs, rcache);
+        }
+
         // load to cache, first condition can no longer fail
         LFS_ASSERT(block < lfs->cfg->block_count);
         rcache->block = block;
@@ -96,7 +402,7 @@ static int lfs_bd_read(lfs_t *lfs,
                     lfs->cfg->block_size)
                 - rcache->off,
                 lfs->cfg->cache_size);
-        int err = lfs->cfg->read(lfs->cfg, rcache->block,
+        err = lfs->cfg->read(lfs->cfg, rcache->block,
                 rcache->off, rcache->buffer, rcache->size);
         LFS_ASSERT(err <= 0);
         if (err) {
@@ -146,13 +452,28 @@ static int lfs_bd_flush(lfs_t *lfs,
     if (pcache->block != LFS_BLOCK_NULL && pcache->block != LFS_BLOCK_INLINE) {
         LFS_ASSERT(pcache->block < lfs->cfg->block_count);
         lfs_size_t diff = lfs_alignup(pcache->size, lfs->cfg->prog_size);
-        int err = lfs->cfg->prog(lfs->cfg, pcache->block,
+        int err = lfs_bd_wait(lfs);
+        if (err) {
+            return err;
+        }
+
+        if (pcache->block == lfs->erasing.bad) {
+            // erasing this block failed
+            lfs->erasing.bad = LFS_BLOCK_NULL;
+            return LFS_ERR_CORRUPT;
+        }
+
+        err = lfs->cfg->prog(lfs->cfg, pcache->block,
                 pcache->off, pcache->buffer, diff);
         LFS_ASSERT(err <= 0);
         if (err) {
             return err;
         }
 
+        lfs_rset_drop(lfs, pcache->block);
+        lfs_dircache_drop(lfs, pcache->block);
+        lfs_pool_take(lfs, pcache->block);
+
         if (validate) {
             // check data on disk
             lfs_cache_drop(lfs, rcache);
@@ -185,6 +506,11 @@ static int lfs_bd_sync(lfs_t *lfs,
         return err;
     }
 
+    err = lfs_bd_wait(lfs);
+    if (err) {
+        return err;
+    }
+
     err = lfs->cfg->sync(lfs->cfg);
     LFS_ASSERT(err <= 0);
     return err;
@@ -242,7 +568,42 @@ static int lfs_bd_prog(lfs_t *lfs,
 #ifndef LFS_READONLY
 static int lfs_bd_erase(lfs_t *lfs, lfs_block_t block) {
     LFS_ASSERT(block < lfs->cfg->block_count);
-    int err = lfs->cfg->erase(lfs->cfg, block);
+    lfs_rset_drop(lfs, block);
+    lfs_dircache_drop(lfs, block);
+    lfs_mcache_drop(lfs, block);
+    lfs_vcache_drop(lfs, block);
+    if (lfs_pool_take(lfs, block)) {
+        // erased ahead of time and not programmed since
+        return 0;
+    }
+
+    int err = lfs_bd_wait(lfs);
+    if (err) {
+        return err;
+    }
+
+    if (lfs->erasing.bad == block) {
+        // erasing again, forget the earlier failure
+        lfs->erasing.bad = LFS_BLOCK_NULL;
+    }
+
+    // only one failed erase can wait to be reported, while one is pending
+    // erase synchronously so the error isn't lost
+    if (lfs->cfg->erase_async && lfs->erasing.bad == LFS_BLOCK_NULL) {
+        // start erasing, we only wait for it when we need the block
+        // device again
+        err = lfs->cfg->erase_async(lfs->cfg, block);
+        LFS_ASSERT(err <= 0);
+        if (err) {
+            return err;
+        }
+
+        lfs->erasing.block = block;
+        lfs->erasing.busy = true;
+        return 0;
+    }
+
+    err = lfs->cfg->erase(lfs->cfg, block);
     LFS_ASSERT(err <= 0);
     return err;
 }
@@ -425,6 +786,38 @@ static inline void lfs_superblock_tole32(lfs_superblock_t *superblock) {
     superblock->attr_max    = lfs_tole32(superblock->attr_max);
 }
 
+static inline void lfs_checkpoint_fromle32(lfs_checkpoint_t *checkpoint) {
+    lfs_gstate_fromle32(&checkpoint->gstate);
+    checkpoint->seed  = lfs_fromle32(checkpoint->seed);
+    checkpoint->count = lfs_fromle32(checkpoint->count);
+}
+
+#ifndef LFS_READONLY
+static inline void lfs_checkpoint_tole32(lfs_checkpoint_t *checkpoint) {
+    lfs_gstate_tole32(&checkpoint->gstate);
+    checkpoint->seed  = lfs_tole32(checkpoint->seed);
+    checkpoint->count = lfs_tole32(checkpoint->count);
+}
+#endif
+
+static inline void lfs_checkpoint_pair_fromle32(lfs_checkpoint_pair_t *cpair) {
+    lfs_pair_fromle32(cpair->pair);
+    cpair->rev[0] = lfs_fromle32(cpair->rev[0]);
+    cpair->rev[1] = lfs_fromle32(cpair->rev[1]);
+    cpair->off    = lfs_fromle32(cpair->off);
+    cpair->etag   = lfs_fromle32(cpair->etag);
+}
+
+#ifndef LFS_READONLY
+static inline void lfs_checkpoint_pair_tole32(lfs_checkpoint_pair_t *cpair) {
+    lfs_pair_tole32(cpair->pair);
+    cpair->rev[0] = lfs_tole32(cpair->rev[0]);
+    cpair->rev[1] = lfs_tole32(cpair->rev[1]);
+    cpair->off    = lfs_tole32(cpair->off);
+    cpair->etag   = lfs_tole32(cpair->etag);
+}
+#endif
+
 static inline bool lfs_mlist_isopen(struct lfs_mlist *head,
         struct lfs_mlist *node) {
     for (struct lfs_mlist **p = &head; *p; p = &(*p)->next) {
@@ -436,6 +829,19 @@ static inline bool lfs_mlist_isopen(struct lfs_mlist *head,
     return false;
 }
 
+// check if a file other than the given one is open on this entry
+static inline bool lfs_mlist_isfile(lfs_t *lfs, const struct lfs_mlist *except,
+        const lfs_block_t pair[2], uint16_t id) {
+    for (struct lfs_mlist *p = lfs->mlist; p; p = p->next) {
+        if (p != except && p->type == LFS_TYPE_REG && p->id == id &&
+                lfs_pair_cmp(p->m.pair, pair) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static inline void lfs_mlist_remove(lfs_t *lfs, struct lfs_mlist *mlist) {
     for (struct lfs_mlist **p = &lfs->mlist; *p; p = &(*p)->next) {
         if (*p == mlist) {
@@ -464,6 +870,7 @@ static lfs_ssize_t lfs_file_rawwrite(lfs_t *lfs, lfs_file_t *file,
 static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file);
 static int lfs_file_outline(lfs_t *lfs, lfs_file_t *file);
 static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file);
+static int lfs_txn_flush(lfs_t *lfs, lfs_txn_t *txn, lfs_mdir_t *dir);
 
 static void lfs_fs_preporphans(lfs_t *lfs, int8_t orphans);
 static void lfs_fs_prepmove(lfs_t *lfs,
@@ -475,7 +882,13 @@ static lfs_stag_t lfs_fs_parent(lfs_t *lfs, const lfs_block_t dir[2],
 static int lfs_fs_relocate(lfs_t *lfs,
         const lfs_block_t oldpair[2], lfs_block_t newpair[2]);
 static int lfs_fs_forceconsistency(lfs_t *lfs);
+static int lfs_fs_rawcheckpoint(lfs_t *lfs);
+static int lfs_fs_rawpreerase(lfs_t *lfs);
+static int lfs_fs_rawsync(lfs_t *lfs, uint32_t flags);
+static int lfs_fs_dropcheckpoint(lfs_t *lfs, lfs_mdir_t *dir);
 #endif
+static int lfs_fs_loadcheckpoint(lfs_t *lfs,
+        const lfs_mdir_t *root, lfs_size_t size);
 
 #ifdef LFS_MIGRATE
 static int lfs1_traverse(lfs_t *lfs,
@@ -490,6 +903,7 @@ static int lfs_file_rawclose(lfs_t *lfs, lfs_file_t *file);
 static lfs_soff_t lfs_file_rawsize(lfs_t *lfs, lfs_file_t *file);
 
 static lfs_ssize_t lfs_fs_rawsize(lfs_t *lfs);
+static lfs_ssize_t lfs_fs_rawusage(lfs_t *lfs);
 static int lfs_fs_rawtraverse(lfs_t *lfs,
         int (*cb)(void *data, lfs_block_t block), void *data,
         bool includeorphans);
@@ -529,9 +943,79 @@ static void lfs_alloc_drop(lfs_t *lfs) {
 }
 
 #ifndef LFS_READONLY
+// a lookahead buffer large enough to cover the whole device is kept up to
+// date as blocks are allocated and released instead of being rebuilt
+static inline bool lfs_alloc_ismap(lfs_t *lfs) {
+    return 8*lfs->cfg->lookahead_size >= lfs->cfg->block_count;
+}
+
+static int lfs_alloc_scan(lfs_t *lfs) {
+    lfs->free.off = (lfs->free.off + lfs->free.size)
+            % lfs->cfg->block_count;
+    lfs->free.size = lfs_min(8*lfs->cfg->lookahead_size, lfs->free.ack);
+    lfs->free.i = 0;
+
+    // find mask of free blocks from tree
+    memset(lfs->free.buffer, 0, lfs->cfg->lookahead_size);
+    int err = lfs_fs_rawtraverse(lfs, lfs_alloc_lookahead, lfs, true);
+    if (err) {
+        lfs_alloc_drop(lfs);
+        return err;
+    }
+
+    if (lfs_alloc_ismap(lfs)) {
+        // blocks we've looked at since the last ack may be in use without
+        // being in the tree yet, mark them so the lookahead can cover the
+        // whole device
+        for (lfs_block_t off = lfs->free.size;
+                off < lfs->cfg->block_count; off++) {
+            lfs->free.buffer[off / 32] |= 1U << (off % 32);
+        }
+        lfs->free.size = lfs->cfg->block_count;
+    }
+
+    lfs->free.used = 0;
+    for (lfs_block_t i = 0; i < (lfs->free.size+31) / 32; i++) {
+        lfs->free.used += lfs_popc(lfs->free.buffer[i]);
+    }
+
+    if (lfs_alloc_ismap(lfs) && lfs->free.ack == lfs->cfg->block_count) {
+        // nothing is allocated since the last ack, so the traversal saw
+        // exactly what is in use, start counting from here, this also
+        // forgets anything we leaked since the last scan
+        lfs->usage = lfs->free.used;
+    }
+
+    return 0;
+}
+
+// return a block that is no longer referenced on disk to the lookahead,
+// saving a traversal to find it again
+static void lfs_alloc_release(lfs_t *lfs, lfs_block_t block) {
+    lfs_block_t off = ((block - lfs->free.off)
+            + lfs->cfg->block_count) % lfs->cfg->block_count;
+
+    if (off < lfs->free.size &&
+            (lfs->free.buffer[off / 32] & (1U << (off % 32)))) {
+        lfs->free.buffer[off / 32] &= ~(1U << (off % 32));
+        lfs->free.used -= 1;
+        if (lfs->usage > 0) {
+            lfs->usage -= 1;
+        }
+    }
+}
+
+// a block we handed out or were using turned out to be bad, it stays out
+// of the lookahead until the next scan but is no longer in use
+static void lfs_alloc_bad(lfs_t *lfs) {
+    if (lfs->usage > 0) {
+        lfs->usage -= 1;
+    }
+}
+
 static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
     while (true) {
-        while (lfs->free.i != lfs->free.size) {
+        while (lfs->free.i != lfs->free.size && lfs->free.ack > 0) {
             lfs_block_t off = lfs->free.i;
             lfs->free.i += 1;
             lfs->free.ack -= 1;
@@ -539,10 +1023,15 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
             if (!(lfs->free.buffer[off / 32] & (1U << (off % 32)))) {
                 // found a free block
                 *block = (lfs->free.off + off) % lfs->cfg->block_count;
+                lfs->free.buffer[off / 32] |= 1U << (off % 32);
+                lfs->free.used += 1;
+                if (lfs->usage >= 0) {
+                    lfs->usage += 1;
+                }
 
                 // eagerly find next off so an alloc ack can
                 // discredit old lookahead blocks
-                while (lfs->free.i != lfs->free.size &&
+                while (lfs->free.i != lfs->free.size && lfs->free.ack > 0 &&
                         (lfs->free.buffer[lfs->free.i / 32]
                             & (1U << (lfs->free.i % 32)))) {
                     lfs->free.i += 1;
@@ -560,16 +1049,16 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
             return LFS_ERR_NOSPC;
         }
 
-        lfs->free.off = (lfs->free.off + lfs->free.size)
-                % lfs->cfg->block_count;
-        lfs->free.size = lfs_min(8*lfs->cfg->lookahead_size, lfs->free.ack);
-        lfs->free.i = 0;
+        if (lfs->free.size == lfs->cfg->block_count &&
+                lfs->free.used < lfs->cfg->block_count) {
+            // lookahead covers the whole device and still knows of free
+            // blocks, go around again without traversing the filesystem
+            lfs->free.i = 0;
+            continue;
+        }
 
-        // find mask of free blocks from tree
-        memset(lfs->free.buffer, 0, lfs->cfg->lookahead_size);
-        int err = lfs_fs_rawtraverse(lfs, lfs_alloc_lookahead, lfs, true);
+        int err = lfs_alloc_scan(lfs);
         if (err) {
-            lfs_alloc_drop(lfs);
             return err;
         }
     }
@@ -577,7 +1066,8 @@ static int lfs_alloc(lfs_t *lfs, lfs_block_t *block) {
 #endif
 
 /// Metadata pair and directory operations ///
-static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
+static lfs_stag_t lfs_dir_getslice(lfs_t *lfs,
+        lfs_cache_t *rcache, const lfs_mdir_t *dir,
         lfs_tag_t gmask, lfs_tag_t gtag,
         lfs_off_t goff, void *gbuffer, lfs_size_t gsize) {
     lfs_off_t off = dir->off;
@@ -596,7 +1086,7 @@ static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
         off -= lfs_tag_dsize(ntag);
         lfs_tag_t tag = ntag;
         int err = lfs_bd_read(lfs,
-                NULL, &lfs->rcache, sizeof(ntag),
+                NULL, rcache, sizeof(ntag),
                 dir->pair[0], off, &ntag, sizeof(ntag));
         if (err) {
             return err;
@@ -624,7 +1114,7 @@ static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
 
             lfs_size_t diff = lfs_min(lfs_tag_size(tag), gsize);
             err = lfs_bd_read(lfs,
-                    NULL, &lfs->rcache, diff,
+                    NULL, rcache, diff,
                     dir->pair[0], off+sizeof(tag)+goff, gbuffer, diff);
             if (err) {
                 return err;
@@ -639,9 +1129,10 @@ static lfs_stag_t lfs_dir_getslice(lfs_t *lfs, const lfs_mdir_t *dir,
     return LFS_ERR_NOENT;
 }
 
-static lfs_stag_t lfs_dir_get(lfs_t *lfs, const lfs_mdir_t *dir,
+static lfs_stag_t lfs_dir_get(lfs_t *lfs,
+        lfs_cache_t *rcache, const lfs_mdir_t *dir,
         lfs_tag_t gmask, lfs_tag_t gtag, void *buffer) {
-    return lfs_dir_getslice(lfs, dir,
+    return lfs_dir_getslice(lfs, rcache, dir,
             gmask, gtag,
             0, buffer, lfs_tag_size(gtag));
 }
@@ -697,7 +1188,7 @@ static int lfs_dir_getread(lfs_t *lfs, const lfs_mdir_t *dir,
         rcache->off = lfs_aligndown(off, lfs->cfg->read_size);
         rcache->size = lfs_min(lfs_alignup(off+hint, lfs->cfg->read_size),
                 lfs->cfg->cache_size);
-        int err = lfs_dir_getslice(lfs, dir, gmask, gtag,
+        int err = lfs_dir_getslice(lfs, &lfs->rcache, dir, gmask, gtag,
                 rcache->off, rcache->buffer, rcache->size);
         if (err < 0) {
             return err;
@@ -738,103 +1229,463 @@ static int lfs_dir_traverse_filter(void *p,
 #endif
 
 #ifndef LFS_READONLY
-static int lfs_dir_traverse(lfs_t *lfs,
-        const lfs_mdir_t *dir, lfs_off_t off, lfs_tag_t ptag,
-        const struct lfs_mattr *attrs, int attrcount,
-        lfs_tag_t tmask, lfs_tag_t ttag,
-        uint16_t begin, uint16_t end, int16_t diff,
-        int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data) {
-    // iterate over directory and attrs
-    while (true) {
-        lfs_tag_t tag;
-        const void *buffer;
-        struct lfs_diskoff disk;
-        if (off+lfs_tag_dsize(ptag) < dir->off) {
-            off += lfs_tag_dsize(ptag);
-            int err = lfs_bd_read(lfs,
-                    NULL, &lfs->rcache, sizeof(tag),
-                    dir->pair[0], off, &tag, sizeof(tag));
-            if (err) {
-                return err;
-            }
+// the set of tags that supersede earlier tags, kept at the end of the
+// filter buffer and growing down towards the list of tags
+struct lfs_dir_traverse_keys {
+    uint32_t *buffer;
+    lfs_size_t size;
+    lfs_size_t used;
+    lfs_size_t count;
+    bool later;
+};
 
-            tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
-            disk.block = dir->pair[0];
-            disk.off = off+sizeof(lfs_tag_t);
-            buffer = &disk;
-            ptag = tag;
-        } else if (attrcount > 0) {
-            tag = attrs[0].tag;
-            buffer = attrs[0].buffer;
-            attrs += 1;
-            attrcount -= 1;
-        } else {
-            return 0;
-        }
+static lfs_tag_t lfs_dir_traverse_key(lfs_tag_t tag) {
+    // which mask depends on unique bit in tag structure
+    return tag & ((tag & LFS_MKTAG(0x100, 0, 0))
+            ? LFS_MKTAG(0x7ff, 0x3ff, 0)
+            : LFS_MKTAG(0x700, 0x3ff, 0));
+}
 
-        lfs_tag_t mask = LFS_MKTAG(0x7ff, 0, 0);
-        if ((mask & tmask & tag) != (mask & tmask & ttag)) {
-            continue;
+static bool lfs_dir_traverse_has(const struct lfs_dir_traverse_keys *keys,
+        lfs_tag_t key) {
+    for (lfs_size_t i = 0; i < keys->count; i++) {
+        if (keys->buffer[keys->size-1 - i] == key) {
+            return true;
         }
+    }
 
-        // do we need to filter? inlining the filtering logic here allows
-        // for some minor optimizations
-        if (lfs_tag_id(tmask) != 0) {
-            // scan for duplicates and update tag based on creates/deletes
-            int filter = lfs_dir_traverse(lfs,
-                    dir, off, ptag, attrs, attrcount,
-                    0, 0, 0, 0, 0,
-                    lfs_dir_traverse_filter, &tag);
-            if (filter < 0) {
-                return filter;
-            }
+    return false;
+}
 
-            if (filter) {
+static int lfs_dir_traverse_push(struct lfs_dir_traverse_keys *keys,
+        lfs_tag_t key) {
+    if (lfs_tag_id(key) == 0x3ff || lfs_dir_traverse_has(keys, key)) {
+        // global tags never fall in the range we emit
+        return 0;
+    }
+
+    if (keys->used + keys->count >= keys->size) {
+        return LFS_ERR_NOMEM;
+    }
+
+    keys->buffer[keys->size-1 - keys->count] = key;
+    keys->count += 1;
+    return 0;
+}
+
+static int lfs_dir_traverse_add(void *p,
+        lfs_tag_t tag, const void *buffer) {
+    struct lfs_dir_traverse_keys *keys = p;
+    (void)buffer;
+
+    keys->later = true;
+    if (lfs_tag_type3(tag) == LFS_TYPE_DELETE) {
+        // deletes also supersede every earlier tag with their id
+        int err = lfs_dir_traverse_push(keys,
+                LFS_MKTAG(LFS_TYPE_DELETE, lfs_tag_id(tag), 0));
+        if (err) {
+            return err;
+        }
+    }
+
+    return lfs_dir_traverse_push(keys, lfs_dir_traverse_key(tag));
+}
+
+static void lfs_dir_traverse_splice(struct lfs_dir_traverse_keys *keys,
+        lfs_tag_t splice) {
+    // move keys back to the ids they had before this create/delete
+    uint16_t id = lfs_tag_id(splice);
+    for (lfs_size_t i = 0; i < keys->count; i++) {
+        uint32_t *key = &keys->buffer[keys->size-1 - i];
+        if (lfs_tag_splice(splice) > 0 && lfs_tag_id(*key) == id) {
+            // didn't exist before it was created
+            *key = keys->buffer[keys->size - keys->count];
+            keys->count -= 1;
+            i -= 1;
+        } else if (lfs_tag_id(*key) >= id + (lfs_tag_splice(splice) > 0)) {
+            *key -= LFS_MKTAG(0, lfs_tag_splice(splice), 0);
+        }
+    }
+}
+
+static lfs_ssize_t lfs_dir_traverse_scan(lfs_t *lfs,
+        const lfs_mdir_t *dir, lfs_off_t off, lfs_tag_t ptag,
+        const struct lfs_mattr *attrs, int attrcount) {
+    // find every tag, two words each, tag and offset on disk
+    struct lfs_dir_traverse_keys keys = {
+        .buffer = &lfs->filter.buffer[lfs->filter.off],
+        .size = lfs->filter.size - lfs->filter.off,
+        .used = 0,
+        .count = 0,
+        .later = false,
+    };
+
+    for (int i = 0; true; keys.used += 2) {
+        lfs_tag_t tag;
+        lfs_off_t diskoff = 0;
+        if (off+lfs_tag_dsize(ptag) < dir->off) {
+            off += lfs_tag_dsize(ptag);
+            int err = lfs_bd_read(lfs,
+                    NULL, &lfs->rcache, sizeof(tag),
+                    dir->pair[0], off, &tag, sizeof(tag));
+            if (err) {
+                return err;
+            }
+
+            tag = (lfs_frombe32(tag) ^ ptag) | 0x80000000;
+            diskoff = off+sizeof(lfs_tag_t);
+            ptag = tag;
+        } else if (i < attrcount) {
+            tag = attrs[i].tag;
+            i += 1;
+        } else {
+            break;
+        }
+
+        if (keys.used+2 > keys.size) {
+            return LFS_ERR_NOMEM;
+        }
+
+        keys.buffer[keys.used+0] = tag;
+        keys.buffer[keys.used+1] = diskoff;
+    }
+
+    // work backwards, a tag is superseded if any later tag has the same
+    // type and id, after adjusting for creates and deletes in between
+    lfs_size_t disk = keys.used/2 - attrcount;
+    for (lfs_size_t i = keys.used; i > 0; i -= 2) {
+        lfs_tag_t tag = keys.buffer[i-2];
+        const void *buffer = ((i-2)/2 >= disk)
+                ? attrs[(i-2)/2 - disk].buffer
+                : NULL;
+        if ((keys.later && lfs_tag_isdelete(tag)) ||
+                lfs_dir_traverse_has(&keys, lfs_dir_traverse_key(tag)) ||
+                lfs_dir_traverse_has(&keys,
+                    LFS_MKTAG(LFS_TYPE_DELETE, lfs_tag_id(tag), 0))) {
+            keys.buffer[i-1] = 0xffffffff;
+        }
+
+        if (lfs_tag_type1(tag) == LFS_TYPE_SPLICE) {
+            lfs_dir_traverse_splice(&keys, tag);
+        }
+
+        // special cases supersede whatever they expand to, except for
+        // moves, a move always follows the create of its id, so the tags
+        // it expands to can't supersede anything
+        if (lfs_tag_type3(tag) == LFS_FROM_NOOP ||
+                lfs_tag_type3(tag) == LFS_FROM_MOVE) {
+            // do nothing
+        } else if (lfs_tag_type3(tag) == LFS_FROM_USERATTRS) {
+            for (unsigned j = 0; j < lfs_tag_size(tag); j++) {
+                const struct lfs_attr *a = buffer;
+                int err = lfs_dir_traverse_add(&keys,
+                        LFS_MKTAG(LFS_TYPE_USERATTR + a[j].type,
+                            lfs_tag_id(tag), a[j].size), NULL);
+                if (err) {
+                    return err;
+                }
+            }
+        } else {
+            int err = lfs_dir_traverse_add(&keys, tag, NULL);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return keys.used/2;
+}
+
+// where a traversal is in a directory and the attrs being committed to it
+struct lfs_dir_traverse_pos {
+    lfs_off_t off;
+    lfs_tag_t ptag;
+    const struct lfs_mattr *attrs;
+    int attrcount;
+};
+
+struct lfs_dir_traverse {
+    const lfs_mdir_t *dir;
+    struct lfs_dir_traverse_pos pos;
+
+    // tags found by lfs_dir_traverse_scan, or NULL if we filter as we go
+    const uint32_t *tags;
+    lfs_size_t count;
+    lfs_size_t i;
+
+    lfs_tag_t tmask;
+    lfs_tag_t ttag;
+    uint16_t begin;
+    uint16_t end;
+    int16_t diff;
+};
+
+static int lfs_dir_traverse_begin(lfs_t *lfs, struct lfs_dir_traverse *t) {
+    // filtering one tag at a time is quadratic, if we have a filter buffer
+    // find superseded tags in one pass up front
+    t->tags = NULL;
+    if (lfs_tag_id(t->tmask) != 0 && lfs->filter.off < lfs->filter.size) {
+        lfs_ssize_t count = lfs_dir_traverse_scan(lfs, t->dir,
+                t->pos.off, t->pos.ptag, t->pos.attrs, t->pos.attrcount);
+        if (count >= 0) {
+            // keep our tags, nested traversals get the rest of the
+            // filter buffer
+            t->tags = &lfs->filter.buffer[lfs->filter.off];
+            t->count = count;
+            t->i = 0;
+            lfs->filter.off += 2*count;
+        } else if (count != LFS_ERR_NOMEM) {
+            return count;
+        }
+    }
+
+    return 0;
+}
+
+// find the next tag in a directory and then the attrs being committed
+static int lfs_dir_traverse_step(lfs_t *lfs, const lfs_mdir_t *dir,
+        struct lfs_dir_traverse_pos *pos,
+        lfs_tag_t *tag, const void **buffer, struct lfs_diskoff *disk) {
+    if (pos->off+lfs_tag_dsize(pos->ptag) < dir->off) {
+        pos->off += lfs_tag_dsize(pos->ptag);
+        lfs_tag_t ntag;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, sizeof(ntag),
+                dir->pair[0], pos->off, &ntag, sizeof(ntag));
+        if (err) {
+            return err;
+        }
+
+        ntag = (lfs_frombe32(ntag) ^ pos->ptag) | 0x80000000;
+        disk->block = dir->pair[0];
+        disk->off = pos->off+sizeof(lfs_tag_t);
+        *buffer = disk;
+        pos->ptag = ntag;
+        *tag = ntag;
+        return true;
+    } else if (pos->attrcount > 0) {
+        *tag = pos->attrs[0].tag;
+        *buffer = pos->attrs[0].buffer;
+        pos->attrs += 1;
+        pos->attrcount -= 1;
+        return true;
+    }
+
+    return false;
+}
+
+static int lfs_dir_traverse_next(lfs_t *lfs, struct lfs_dir_traverse *t,
+        lfs_tag_t *tag, const void **buffer, struct lfs_diskoff *disk) {
+    lfs_tag_t mask = LFS_MKTAG(0x7ff, 0, 0);
+
+    // next tag found by the scan? these are already filtered
+    while (t->tags) {
+        if (t->i >= t->count) {
+            return false;
+        }
+
+        lfs_size_t i = t->i;
+        t->i += 1;
+        lfs_tag_t ntag = t->tags[2*i+0];
+        if ((mask & t->tmask & ntag) != (mask & t->tmask & t->ttag) ||
+                t->tags[2*i+1] == 0xffffffff) {
+            continue;
+        }
+
+        // update tag based on creates/deletes
+        for (lfs_size_t j = i+1; j < t->count; j++) {
+            if (lfs_tag_type1(t->tags[2*j]) == LFS_TYPE_SPLICE &&
+                    lfs_tag_id(t->tags[2*j]) <= lfs_tag_id(ntag)) {
+                ntag += LFS_MKTAG(0, lfs_tag_splice(t->tags[2*j]), 0);
+            }
+        }
+
+        // in filter range?
+        if (!(lfs_tag_id(ntag) >= t->begin && lfs_tag_id(ntag) < t->end)) {
+            continue;
+        }
+
+        lfs_size_t ondisk = t->count - t->pos.attrcount;
+        if (i < ondisk) {
+            disk->block = t->dir->pair[0];
+            disk->off = t->tags[2*i+1];
+            *buffer = disk;
+        } else {
+            *buffer = t->pos.attrs[i - ondisk].buffer;
+        }
+
+        *tag = ntag;
+        return true;
+    }
+
+    // otherwise iterate over directory and attrs
+    while (true) {
+        int res = lfs_dir_traverse_step(lfs, t->dir, &t->pos,
+                tag, buffer, disk);
+        if (res <= 0) {
+            return res;
+        }
+
+        if ((mask & t->tmask & *tag) == (mask & t->tmask & t->ttag)) {
+            return true;
+        }
+    }
+}
+
+// check if anything after where a traversal is makes its current tag
+// redundant, this also updates the tag based on creates/deletes
+static int lfs_dir_traverse_redundant(lfs_t *lfs,
+        const struct lfs_dir_traverse *t, lfs_tag_t *tag) {
+    // carry on from where the traversal is without disturbing it
+    struct lfs_dir_traverse_pos pos = t->pos;
+    while (true) {
+        lfs_tag_t ftag;
+        const void *buffer;
+        struct lfs_diskoff disk;
+        int res = lfs_dir_traverse_step(lfs, t->dir, &pos,
+                &ftag, &buffer, &disk);
+        if (res <= 0) {
+            return res;
+        }
+
+        if (lfs_tag_type3(ftag) == LFS_FROM_USERATTRS) {
+            const struct lfs_attr *a = buffer;
+            for (unsigned i = 0; i < lfs_tag_size(ftag); i++) {
+                res = lfs_dir_traverse_filter(tag,
+                        LFS_MKTAG(LFS_TYPE_USERATTR + a[i].type,
+                            lfs_tag_id(ftag), a[i].size), a[i].buffer);
+                if (res) {
+                    return res;
+                }
+            }
+        } else if (lfs_tag_type3(ftag) != LFS_FROM_NOOP &&
+                lfs_tag_type3(ftag) != LFS_FROM_MOVE) {
+            // a move always follows the create of its id, so the tags it
+            // expands to can't make an earlier tag redundant, no need to
+            // traverse the source
+            res = lfs_dir_traverse_filter(tag, ftag, buffer);
+            if (res) {
+                return res;
+            }
+        }
+    }
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_dir_traverse(lfs_t *lfs,
+        const lfs_mdir_t *dir, lfs_off_t off, lfs_tag_t ptag,
+        const struct lfs_mattr *attrs, int attrcount,
+        lfs_tag_t tmask, lfs_tag_t ttag,
+        uint16_t begin, uint16_t end, int16_t diff,
+        int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data) {
+    // the only traversal that nests is the one into the source of a move,
+    // and that can't nest any further, so instead of recursing we keep the
+    // traversal we return to here, this keeps our stack usage bounded and
+    // visible to static analysis
+    struct lfs_dir_traverse parent;
+    bool nested = false;
+    const lfs_size_t base = lfs->filter.off;
+
+    struct lfs_dir_traverse t = {
+        .dir        = dir,
+        .pos        = {off, ptag, attrs, attrcount},
+        .tmask      = tmask,
+        .ttag       = ttag,
+        .begin      = begin,
+        .end        = end,
+        .diff       = diff,
+    };
+    int res = lfs_dir_traverse_begin(lfs, &t);
+    if (res) {
+        return res;
+    }
+
+    while (true) {
+        lfs_tag_t tag;
+        const void *buffer;
+        struct lfs_diskoff disk;
+        res = lfs_dir_traverse_next(lfs, &t, &tag, &buffer, &disk);
+        if (res < 0) {
+            break;
+        }
+
+        if (!res) {
+            // finished this traversal, return to the one we came from
+            if (t.tags) {
+                lfs->filter.off -= 2*t.count;
+            }
+
+            if (!nested) {
+                break;
+            }
+
+            nested = false;
+            t = parent;
+            continue;
+        }
+
+        if (!t.tags && lfs_tag_id(t.tmask) != 0) {
+            // scan for duplicates and update tag based on creates/deletes
+            res = lfs_dir_traverse_redundant(lfs, &t, &tag);
+            if (res < 0) {
+                break;
+            } else if (res) {
                 continue;
             }
 
             // in filter range?
-            if (!(lfs_tag_id(tag) >= begin && lfs_tag_id(tag) < end)) {
+            if (!(lfs_tag_id(tag) >= t.begin && lfs_tag_id(tag) < t.end)) {
                 continue;
             }
         }
 
         // handle special cases for mcu-side operations
+        res = 0;
         if (lfs_tag_type3(tag) == LFS_FROM_NOOP) {
             // do nothing
         } else if (lfs_tag_type3(tag) == LFS_FROM_MOVE) {
+            // traverse the source, a move's source is always on disk so
+            // this can't nest any further moves
+            LFS_ASSERT(!nested);
+            parent = t;
+            nested = true;
+
             uint16_t fromid = lfs_tag_size(tag);
             uint16_t toid = lfs_tag_id(tag);
-            int err = lfs_dir_traverse(lfs,
-                    buffer, 0, 0xffffffff, NULL, 0,
-                    LFS_MKTAG(0x600, 0x3ff, 0),
-                    LFS_MKTAG(LFS_TYPE_STRUCT, 0, 0),
-                    fromid, fromid+1, toid-fromid+diff,
-                    cb, data);
-            if (err) {
-                return err;
-            }
+            t.dir = buffer;
+            t.pos = (struct lfs_dir_traverse_pos){0, 0xffffffff, NULL, 0};
+            t.tmask = LFS_MKTAG(0x600, 0x3ff, 0);
+            t.ttag = LFS_MKTAG(LFS_TYPE_STRUCT, 0, 0);
+            t.begin = fromid;
+            t.end = fromid+1;
+            t.diff = toid-fromid+t.diff;
+            res = lfs_dir_traverse_begin(lfs, &t);
         } else if (lfs_tag_type3(tag) == LFS_FROM_USERATTRS) {
             for (unsigned i = 0; i < lfs_tag_size(tag); i++) {
                 const struct lfs_attr *a = buffer;
-                int err = cb(data, LFS_MKTAG(LFS_TYPE_USERATTR + a[i].type,
-                        lfs_tag_id(tag) + diff, a[i].size), a[i].buffer);
-                if (err) {
-                    return err;
+                res = cb(data, LFS_MKTAG(LFS_TYPE_USERATTR + a[i].type,
+                        lfs_tag_id(tag) + t.diff, a[i].size), a[i].buffer);
+                if (res) {
+                    break;
                 }
             }
         } else {
-            int err = cb(data, tag + LFS_MKTAG(0, diff, 0), buffer);
-            if (err) {
-                return err;
-            }
+            res = cb(data, tag + LFS_MKTAG(0, t.diff, 0), buffer);
+        }
+
+        if (res) {
+            break;
         }
     }
+
+    lfs->filter.off = base;
+    return res;
 }
 #endif
 
 static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
-        lfs_mdir_t *dir, const lfs_block_t pair[2],
+        lfs_cache_t *rcache, lfs_mdir_t *dir, const lfs_block_t pair[2],
         lfs_tag_t fmask, lfs_tag_t ftag, uint16_t *id,
         int (*cb)(void *data, lfs_tag_t tag, const void *buffer), void *data) {
     // we can find tag very efficiently during a fetch, since we're already
@@ -849,11 +1700,41 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
 
     // find the block with the most recent revision
     uint32_t revs[2] = {0, 0};
+    bool fetched = false;
+    if (lfs->cfg->readv && sizeof(revs[0]) % lfs->cfg->read_size == 0 &&
+            !lfs_bd_iscached(lfs, NULL, rcache, pair[0], 0, sizeof(revs[0])) &&
+            !lfs_bd_iscached(lfs, NULL, rcache, pair[1], 0, sizeof(revs[1]))) {
+        // read both revisions in one call, if either block is bad we read
+        // them one at a time below to find out which one
+        int err = lfs_bd_waitread(lfs, pair[0]);
+        if (!err) {
+            err = lfs_bd_waitread(lfs, pair[1]);
+        }
+        if (err) {
+            return err;
+        }
+
+        const struct lfs_iovec iov[2] = {
+            {pair[0], 0, &revs[0], sizeof(revs[0])},
+            {pair[1], 0, &revs[1], sizeof(revs[1])},
+        };
+        err = lfs->cfg->readv(lfs->cfg, iov, 2);
+        LFS_ASSERT(err <= 0);
+        if (err && err != LFS_ERR_CORRUPT) {
+            return err;
+        }
+
+        fetched = !err;
+    }
+
     int r = 0;
     for (int i = 0; i < 2; i++) {
-        int err = lfs_bd_read(lfs,
-                NULL, &lfs->rcache, sizeof(revs[i]),
-                pair[i], 0, &revs[i], sizeof(revs[i]));
+        int err = 0;
+        if (!fetched) {
+            err = lfs_bd_read(lfs,
+                    NULL, rcache, sizeof(revs[i]),
+                    pair[i], 0, &revs[i], sizeof(revs[i]));
+        }
         revs[i] = lfs_fromle32(revs[i]);
         if (err && err != LFS_ERR_CORRUPT) {
             return err;
@@ -880,6 +1761,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
         bool tempsplit = false;
         lfs_stag_t tempbesttag = besttag;
 
+        // commits before voff have already been checked this mount
+        lfs_off_t voff = lfs_vcache_get(lfs, dir->pair[0], dir->rev);
+
         dir->rev = lfs_tole32(dir->rev);
         uint32_t crc = lfs_crc(0xffffffff, &dir->rev, sizeof(dir->rev));
         dir->rev = lfs_fromle32(dir->rev);
@@ -889,7 +1773,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             lfs_tag_t tag;
             off += lfs_tag_dsize(ptag);
             int err = lfs_bd_read(lfs,
-                    NULL, &lfs->rcache, lfs->cfg->block_size,
+                    NULL, rcache, lfs->cfg->block_size,
                     dir->pair[0], off, &tag, sizeof(tag));
             if (err) {
                 if (err == LFS_ERR_CORRUPT) {
@@ -919,7 +1803,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 // check the crc attr
                 uint32_t dcrc;
                 err = lfs_bd_read(lfs,
-                        NULL, &lfs->rcache, lfs->cfg->block_size,
+                        NULL, rcache, lfs->cfg->block_size,
                         dir->pair[0], off+sizeof(tag), &dcrc, sizeof(dcrc));
                 if (err) {
                     if (err == LFS_ERR_CORRUPT) {
@@ -930,7 +1814,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 }
                 dcrc = lfs_fromle32(dcrc);
 
-                if (crc != dcrc) {
+                if (off >= voff && crc != dcrc) {
                     dir->erased = false;
                     break;
                 }
@@ -942,7 +1826,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 // pseudorandom numbers, note we use another crc here
                 // as a collection function because it is sufficiently
                 // random and convenient
-                lfs->seed = lfs_crc(lfs->seed, &crc, sizeof(crc));
+                lfs->seed = lfs_crc(lfs->seed, &dcrc, sizeof(dcrc));
 
                 // update with what's found so far
                 besttag = tempbesttag;
@@ -959,10 +1843,11 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
             }
 
             // crc the entry first, hopefully leaving it in the cache
-            for (lfs_off_t j = sizeof(tag); j < lfs_tag_dsize(tag); j++) {
+            for (lfs_off_t j = sizeof(tag);
+                    off >= voff && j < lfs_tag_dsize(tag); j++) {
                 uint8_t dat;
                 err = lfs_bd_read(lfs,
-                        NULL, &lfs->rcache, lfs->cfg->block_size,
+                        NULL, rcache, lfs->cfg->block_size,
                         dir->pair[0], off+j, &dat, 1);
                 if (err) {
                     if (err == LFS_ERR_CORRUPT) {
@@ -995,7 +1880,7 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
                 tempsplit = (lfs_tag_chunk(tag) & 1);
 
                 err = lfs_bd_read(lfs,
-                        NULL, &lfs->rcache, lfs->cfg->block_size,
+                        NULL, rcache, lfs->cfg->block_size,
                         dir->pair[0], off+sizeof(tag), &temptail, 8);
                 if (err) {
                     if (err == LFS_ERR_CORRUPT) {
@@ -1036,6 +1921,9 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
 
         // consider what we have good enough
         if (dir->off > 0) {
+            lfs_mcache_put(lfs, dir);
+            lfs_vcache_put(lfs, dir->pair[0], dir->rev, dir->off);
+
             // synthetic move
             if (lfs_gstate_hasmovehere(&lfs->gdisk, dir->pair)) {
                 if (lfs_tag_id(lfs->gdisk.tag) == lfs_tag_id(besttag)) {
@@ -1071,17 +1959,24 @@ static lfs_stag_t lfs_dir_fetchmatch(lfs_t *lfs,
 }
 
 static int lfs_dir_fetch(lfs_t *lfs,
-        lfs_mdir_t *dir, const lfs_block_t pair[2]) {
+        lfs_cache_t *rcache, lfs_mdir_t *dir, const lfs_block_t pair[2]) {
+    // nothing has changed since we last scanned this pair?
+    const lfs_mdir_t *m = lfs_mcache_get(lfs, pair);
+    if (m && !lfs_pair_isnull(m->pair) && lfs_pair_sync(m->pair, pair)) {
+        *dir = *m;
+        return 0;
+    }
+
     // note, mask=-1, tag=-1 can never match a tag since this
     // pattern has the invalid bit set
-    return (int)lfs_dir_fetchmatch(lfs, dir, pair,
+    return (int)lfs_dir_fetchmatch(lfs, rcache, dir, pair,
             (lfs_tag_t)-1, (lfs_tag_t)-1, NULL, NULL, NULL);
 }
 
 static int lfs_dir_getgstate(lfs_t *lfs, const lfs_mdir_t *dir,
         lfs_gstate_t *gstate) {
     lfs_gstate_t temp;
-    lfs_stag_t res = lfs_dir_get(lfs, dir, LFS_MKTAG(0x7ff, 0, 0),
+    lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, dir, LFS_MKTAG(0x7ff, 0, 0),
             LFS_MKTAG(LFS_TYPE_MOVESTATE, 0, sizeof(temp)), &temp);
     if (res < 0 && res != LFS_ERR_NOENT) {
         return res;
@@ -1096,7 +1991,8 @@ static int lfs_dir_getgstate(lfs_t *lfs, const lfs_mdir_t *dir,
     return 0;
 }
 
-static int lfs_dir_getinfo(lfs_t *lfs, lfs_mdir_t *dir,
+static int lfs_dir_getinfo(lfs_t *lfs,
+        lfs_cache_t *rcache, lfs_mdir_t *dir,
         uint16_t id, struct lfs_info *info) {
     if (id == 0x3ff) {
         // special case for root
@@ -1105,7 +2001,8 @@ static int lfs_dir_getinfo(lfs_t *lfs, lfs_mdir_t *dir,
         return 0;
     }
 
-    lfs_stag_t tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x780, 0x3ff, 0),
+    lfs_stag_t tag = lfs_dir_get(lfs, rcache, dir,
+            LFS_MKTAG(0x780, 0x3ff, 0),
             LFS_MKTAG(LFS_TYPE_NAME, id, lfs->name_max+1), info->name);
     if (tag < 0) {
         return (int)tag;
@@ -1114,7 +2011,7 @@ static int lfs_dir_getinfo(lfs_t *lfs, lfs_mdir_t *dir,
     info->type = lfs_tag_type3(tag);
 
     struct lfs_ctz ctz;
-    tag = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
+    tag = lfs_dir_get(lfs, rcache, dir, LFS_MKTAG(0x700, 0x3ff, 0),
             LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
     if (tag < 0) {
         return (int)tag;
@@ -1132,20 +2029,35 @@ static int lfs_dir_getinfo(lfs_t *lfs, lfs_mdir_t *dir,
 
 struct lfs_dir_find_match {
     lfs_t *lfs;
+    lfs_cache_t *rcache;
     const void *name;
     lfs_size_t size;
+    struct lfs_dpair *dpair;
 };
 
+static int lfs_dindex_grow(lfs_t *lfs,
+        lfs_cache_t *rcache, struct lfs_dpair *dpair,
+        lfs_tag_t tag, const struct lfs_diskoff *disk);
+
 static int lfs_dir_find_match(void *data,
         lfs_tag_t tag, const void *buffer) {
     struct lfs_dir_find_match *name = data;
     lfs_t *lfs = name->lfs;
     const struct lfs_diskoff *disk = buffer;
 
+    // keep track of the largest name if we're indexing this pair
+    if (name->dpair) {
+        int err = lfs_dindex_grow(lfs, name->rcache, name->dpair,
+                tag, disk);
+        if (err) {
+            return err;
+        }
+    }
+
     // compare with disk
     lfs_size_t diff = lfs_min(name->size, lfs_tag_size(tag));
     int res = lfs_bd_cmp(lfs,
-            NULL, &lfs->rcache, diff,
+            NULL, name->rcache, diff,
             disk->block, disk->off, name->name, diff);
     if (res != LFS_CMP_EQ) {
         return res;
@@ -1160,55 +2072,203 @@ static int lfs_dir_find_match(void *data,
     return LFS_CMP_EQ;
 }
 
-static lfs_stag_t lfs_dir_find(lfs_t *lfs, lfs_mdir_t *dir,
-        const char **path, uint16_t *id) {
-    // we reduce path to a single name if we can find it
-    const char *name = *path;
-    if (id) {
-        *id = 0x3ff;
+/// Path lookup cache ///
+static void lfs_dcache_reset(lfs_t *lfs) {
+    for (lfs_size_t i = 0; i < lfs->dcache.count; i++) {
+        lfs->dcache.entries[i].size = 0;
     }
+}
 
-    // default to root dir
-    lfs_stag_t tag = LFS_MKTAG(LFS_TYPE_DIR, 0x3ff, 0);
-    dir->tail[0] = lfs->root[0];
-    dir->tail[1] = lfs->root[1];
+static struct lfs_dentry *lfs_dcache_get(lfs_t *lfs,
+        const lfs_block_t parent[2], const char *name, lfs_size_t namelen) {
+    uint32_t hash = lfs_crc(parent[0] ^ parent[1], name, namelen);
+    return &lfs->dcache.entries[hash % lfs->dcache.count];
+}
 
-    while (true) {
-nextname:
-        // skip slashes
-        name += strspn(name, "/");
-        lfs_size_t namelen = strcspn(name, "/");
+static const struct lfs_dentry *lfs_dcache_find(lfs_t *lfs,
+        const lfs_block_t parent[2], const char *name, lfs_size_t namelen) {
+    if (!lfs->dcache.count || namelen > LFS_DCACHE_NAME_MAX) {
+        return NULL;
+    }
 
-        // skip '.' and root '..'
-        if ((namelen == 1 && memcmp(name, ".", 1) == 0) ||
-            (namelen == 2 && memcmp(name, "..", 2) == 0)) {
-            name += namelen;
-            goto nextname;
-        }
+    const struct lfs_dentry *dentry = lfs_dcache_get(lfs,
+            parent, name, namelen);
+    if (dentry->size != namelen ||
+            !lfs_pair_sync(dentry->parent, parent) ||
+            memcmp(dentry->name, name, namelen) != 0) {
+        return NULL;
+    }
 
-        // skip if matched by '..' in name
-        const char *suffix = name + namelen;
-        lfs_size_t sufflen;
-        int depth = 1;
-        while (true) {
-            suffix += strspn(suffix, "/");
-            sufflen = strcspn(suffix, "/");
-            if (sufflen == 0) {
-                break;
-            }
+    return dentry;
+}
 
-            if (sufflen == 2 && memcmp(suffix, "..", 2) == 0) {
-                depth -= 1;
-                if (depth == 0) {
-                    name = suffix + sufflen;
-                    goto nextname;
-                }
-            } else {
-                depth += 1;
-            }
+static void lfs_dcache_push(lfs_t *lfs,
+        const lfs_block_t parent[2], const char *name, lfs_size_t namelen,
+        const lfs_mdir_t *dir, lfs_tag_t tag, uint16_t id) {
+    if (!lfs->dcache.count || namelen > LFS_DCACHE_NAME_MAX) {
+        return;
+    }
 
-            suffix += sufflen;
-        }
+    struct lfs_dentry *dentry = lfs_dcache_get(lfs, parent, name, namelen);
+    dentry->parent[0] = parent[0];
+    dentry->parent[1] = parent[1];
+    dentry->m = *dir;
+    dentry->tag = tag;
+    dentry->id = id;
+    dentry->size = namelen;
+    memcpy(dentry->name, name, namelen);
+}
+
+#ifndef LFS_READONLY
+static void lfs_dcache_drop(lfs_t *lfs, const lfs_block_t pair[2]) {
+    // pair is being modified, forget any lookups that went through it
+    // or ended in it, including names that were not found
+    for (lfs_size_t i = 0; i < lfs->dcache.count; i++) {
+        struct lfs_dentry *dentry = &lfs->dcache.entries[i];
+        if (dentry->size && (lfs_pair_cmp(dentry->parent, pair) == 0 ||
+                lfs_pair_cmp(dentry->m.pair, pair) == 0)) {
+            dentry->size = 0;
+        }
+    }
+}
+#endif
+
+/// Directory index ///
+static void lfs_dindex_reset(lfs_t *lfs) {
+    for (lfs_size_t i = 0; i < lfs->dindex.count; i++) {
+        lfs->dindex.entries[i].pair[0] = LFS_BLOCK_NULL;
+        lfs->dindex.entries[i].pair[1] = LFS_BLOCK_NULL;
+    }
+}
+
+static struct lfs_dpair *lfs_dindex_get(lfs_t *lfs, const lfs_block_t pair[2]) {
+    if (!lfs->dindex.count) {
+        return NULL;
+    }
+
+    return &lfs->dindex.entries[
+            (pair[0] ^ pair[1]) % lfs->dindex.count];
+}
+
+static int lfs_dindex_cmp(const char *a, lfs_size_t asize,
+        const char *b, lfs_size_t bsize) {
+    // same order as lfs_dir_find_match, with a on disk and b the name
+    // we're looking for
+    int res = memcmp(a, b, lfs_min(asize, bsize));
+    if (res) {
+        return res < 0 ? LFS_CMP_LT : LFS_CMP_GT;
+    }
+
+    if (asize != bsize) {
+        return (bsize < asize) ? LFS_CMP_LT : LFS_CMP_GT;
+    }
+
+    return LFS_CMP_EQ;
+}
+
+static int lfs_dindex_grow(lfs_t *lfs,
+        lfs_cache_t *rcache, struct lfs_dpair *dpair,
+        lfs_tag_t tag, const struct lfs_diskoff *disk) {
+    if (dpair->size > LFS_DINDEX_NAME_MAX) {
+        return 0;
+    } else if (lfs_tag_size(tag) > LFS_DINDEX_NAME_MAX) {
+        // too long to remember, this pair can't be skipped
+        dpair->size = LFS_DINDEX_NAME_MAX+1;
+        return 0;
+    }
+
+    char name[LFS_DINDEX_NAME_MAX];
+    int err = lfs_bd_read(lfs,
+            NULL, rcache, lfs_tag_size(tag),
+            disk->block, disk->off, name, lfs_tag_size(tag));
+    if (err) {
+        return err;
+    }
+
+    if (dpair->size == 0 || lfs_dindex_cmp(name, lfs_tag_size(tag),
+            dpair->name, dpair->size) == LFS_CMP_GT) {
+        memcpy(dpair->name, name, lfs_tag_size(tag));
+        dpair->size = lfs_tag_size(tag);
+    }
+
+    return 0;
+}
+
+static const struct lfs_dpair *lfs_dindex_find(lfs_t *lfs,
+        const lfs_block_t pair[2], const char *name, lfs_size_t namelen) {
+    // directories are sorted, so if every name in this pair comes before
+    // our name, and the directory continues, our name can't be here
+    const struct lfs_dpair *dpair = lfs_dindex_get(lfs, pair);
+    if (!dpair || !lfs_pair_sync(dpair->pair, pair) || !dpair->split ||
+            dpair->size > LFS_DINDEX_NAME_MAX ||
+            (dpair->size > 0 && lfs_dindex_cmp(dpair->name, dpair->size,
+                name, namelen) != LFS_CMP_LT)) {
+        return NULL;
+    }
+
+    return dpair;
+}
+
+#ifndef LFS_READONLY
+static void lfs_dindex_drop(lfs_t *lfs, const lfs_block_t pair[2]) {
+    struct lfs_dpair *dpair = lfs_dindex_get(lfs, pair);
+    if (dpair && lfs_pair_sync(dpair->pair, pair)) {
+        dpair->pair[0] = LFS_BLOCK_NULL;
+        dpair->pair[1] = LFS_BLOCK_NULL;
+    }
+}
+#endif
+
+static lfs_stag_t lfs_dir_find(lfs_t *lfs,
+        lfs_cache_t *rcache, lfs_mdir_t *dir,
+        const char **path, uint16_t *id) {
+    // we reduce path to a single name if we can find it
+    const char *name = *path;
+    if (id) {
+        *id = 0x3ff;
+    }
+
+    // default to root dir
+    lfs_stag_t tag = LFS_MKTAG(LFS_TYPE_DIR, 0x3ff, 0);
+    dir->tail[0] = lfs->root[0];
+    dir->tail[1] = lfs->root[1];
+
+    while (true) {
+nextname:
+        // skip slashes
+        name += strspn(name, "/");
+        lfs_size_t namelen = strcspn(name, "/");
+
+        // skip '.' and root '..'
+        if ((namelen == 1 && memcmp(name, ".", 1) == 0) ||
+            (namelen == 2 && memcmp(name, "..", 2) == 0)) {
+            name += namelen;
+            goto nextname;
+        }
+
+        // skip if matched by '..' in name
+        const char *suffix = name + namelen;
+        lfs_size_t sufflen;
+        int depth = 1;
+        while (true) {
+            suffix += strspn(suffix, "/");
+            sufflen = strcspn(suffix, "/");
+            if (sufflen == 0) {
+                break;
+            }
+
+            if (sufflen == 2 && memcmp(suffix, "..", 2) == 0) {
+                depth -= 1;
+                if (depth == 0) {
+                    name = suffix + sufflen;
+                    goto nextname;
+                }
+            } else {
+                depth += 1;
+            }
+
+            suffix += sufflen;
+        }
 
         // found path
         if (name[0] == '\0') {
@@ -1225,7 +2285,8 @@ nextname:
 
         // grab the entry data
         if (lfs_tag_id(tag) != 0x3ff) {
-            lfs_stag_t res = lfs_dir_get(lfs, dir, LFS_MKTAG(0x700, 0x3ff, 0),
+            lfs_stag_t res = lfs_dir_get(lfs, rcache, dir,
+                    LFS_MKTAG(0x700, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_STRUCT, lfs_tag_id(tag), 8), dir->tail);
             if (res < 0) {
                 return res;
@@ -1233,26 +2294,72 @@ nextname:
             lfs_pair_fromle32(dir->tail);
         }
 
-        // find entry matching name
-        while (true) {
-            tag = lfs_dir_fetchmatch(lfs, dir, dir->tail,
-                    LFS_MKTAG(0x780, 0, 0),
-                    LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
-                     // are we last name?
-                    (strchr(name, '/') == NULL) ? id : NULL,
-                    lfs_dir_find_match, &(struct lfs_dir_find_match){
-                        lfs, name, namelen});
-            if (tag < 0) {
-                return tag;
-            }
+        // find entry matching name, we may have looked for it before
+        const lfs_block_t parent[2] = {dir->tail[0], dir->tail[1]};
+        uint16_t nid = 0x3ff;
+        const struct lfs_dentry *dentry = lfs_dcache_find(lfs,
+                parent, name, namelen);
+        if (dentry) {
+            *dir = dentry->m;
+            tag = dentry->tag;
+            nid = dentry->id;
+        } else {
+            while (true) {
+                // skip pairs that can't hold our name
+                const struct lfs_dpair *skip = lfs_dindex_find(lfs,
+                        dir->tail, name, namelen);
+                if (skip) {
+                    dir->tail[0] = skip->tail[0];
+                    dir->tail[1] = skip->tail[1];
+                    continue;
+                }
 
-            if (tag) {
-                break;
-            }
+                // index this pair while we're fetching it
+                struct lfs_dpair *dpair = lfs_dindex_get(lfs, dir->tail);
+                if (dpair) {
+                    dpair->pair[0] = LFS_BLOCK_NULL;
+                    dpair->pair[1] = LFS_BLOCK_NULL;
+                    dpair->size = 0;
+                }
 
-            if (!dir->split) {
-                return LFS_ERR_NOENT;
+                tag = lfs_dir_fetchmatch(lfs, rcache, dir, dir->tail,
+                        LFS_MKTAG(0x780, 0, 0),
+                        LFS_MKTAG(LFS_TYPE_NAME, 0, namelen),
+                        &nid,
+                        lfs_dir_find_match, &(struct lfs_dir_find_match){
+                            lfs, rcache, name, namelen, dpair});
+                if (tag < 0 && tag != LFS_ERR_NOENT) {
+                    return tag;
+                }
+
+                if (dpair) {
+                    dpair->pair[0] = dir->pair[0];
+                    dpair->pair[1] = dir->pair[1];
+                    dpair->tail[0] = dir->tail[0];
+                    dpair->tail[1] = dir->tail[1];
+                    dpair->split = dir->split;
+                }
+
+                if (tag == LFS_ERR_NOENT) {
+                    tag = 0;
+                    break;
+                }
+
+                if (tag || !dir->split) {
+                    break;
+                }
             }
+
+            lfs_dcache_push(lfs, parent, name, namelen, dir, tag, nid);
+        }
+
+        // are we last name?
+        if (id && strchr(name, '/') == NULL) {
+            *id = nid;
+        }
+
+        if (!tag) {
+            return LFS_ERR_NOENT;
         }
 
         // to next name
@@ -1476,6 +2583,9 @@ static int lfs_dir_alloc(lfs_t *lfs, lfs_mdir_t *dir) {
     dir->erased = false;
     dir->split = false;
 
+    // these blocks may have been a pair we indexed before
+    lfs_dindex_drop(lfs, dir->pair);
+
     // don't write out yet, let caller take care of that
     return 0;
 }
@@ -1498,6 +2608,9 @@ static int lfs_dir_drop(lfs_t *lfs, lfs_mdir_t *dir, lfs_mdir_t *tail) {
         return err;
     }
 
+    // tail is no longer reachable
+    lfs_dcache_drop(lfs, tail->pair);
+    lfs_dindex_drop(lfs, tail->pair);
     return 0;
 }
 #endif
@@ -1547,6 +2660,65 @@ static int lfs_dir_commit_size(void *p, lfs_tag_t tag, const void *buffer) {
 }
 #endif
 
+#if !defined(LFS_READONLY) && defined(LFS_SPLIT_SEARCH)
+struct lfs_dir_commit_sizes {
+    lfs_size_t size;
+    uint16_t *sizes;
+    lfs_size_t count;
+};
+
+static int lfs_dir_commit_sizes(void *p, lfs_tag_t tag, const void *buffer) {
+    struct lfs_dir_commit_sizes *sizes = p;
+    lfs_dir_commit_size(&sizes->size, tag, buffer);
+
+    // only the first ids can be split off, entries that saturate are
+    // never considered to fit
+    uint16_t id = lfs_tag_id(tag);
+    if (id < sizes->count) {
+        sizes->sizes[id] = lfs_min(
+                sizes->sizes[id] + lfs_tag_dsize(tag), 0xffff);
+    }
+    return 0;
+}
+
+// find the size of a range of entries and the largest number of them
+// from the start that fits in limit, each entry is only sized once
+static int lfs_dir_splitsearch(lfs_t *lfs, const lfs_mdir_t *source,
+        const struct lfs_mattr *attrs, int attrcount,
+        uint16_t begin, uint16_t end, lfs_size_t limit,
+        lfs_size_t *size, uint16_t *split) {
+    // the sizes live in lfs, we're done with them before compacting
+    // or splitting recurses
+    struct lfs_dir_commit_sizes sizes = {
+        .size = 0,
+        .sizes = lfs->split.sizes,
+        .count = lfs->split.count,
+    };
+    memset(sizes.sizes, 0, sizes.count*sizeof(uint16_t));
+    int err = lfs_dir_traverse(lfs,
+            source, 0, 0xffffffff, attrs, attrcount,
+            LFS_MKTAG(0x400, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
+            begin, end, -begin,
+            lfs_dir_commit_sizes, &sizes);
+    if (err) {
+        return err;
+    }
+
+    *size = sizes.size;
+    *split = 1;
+    lfs_size_t ssize = sizes.sizes[0];
+    while (*split < lfs_min(end - begin - 1, sizes.count) &&
+            sizes.sizes[*split] < 0xffff &&
+            ssize + sizes.sizes[*split] <= limit) {
+        ssize += sizes.sizes[*split];
+        *split += 1;
+    }
+
+    return 0;
+}
+#endif
+
 #ifndef LFS_READONLY
 struct lfs_dir_commit_commit {
     lfs_t *lfs;
@@ -1569,35 +2741,46 @@ static int lfs_dir_compact(lfs_t *lfs,
     const lfs_block_t oldpair[2] = {dir->pair[0], dir->pair[1]};
     bool relocated = false;
     bool tired = false;
+    bool worn = false;
+
+    // space is complicated, we need room for tail, crc, gstate,
+    // cleanup delete, and we cap at half a block to give room
+    // for metadata updates.
+    const lfs_size_t limit = lfs_min(lfs->cfg->block_size - 36,
+            lfs_alignup(lfs->cfg->block_size/2, lfs->cfg->prog_size));
 
     // should we split?
     while (end - begin > 1) {
         // find size
         lfs_size_t size = 0;
+#ifdef LFS_SPLIT_SEARCH
+        // along with the largest number of entries that fits, this packs
+        // large directories into fewer metadata pairs
+        uint16_t split = 1;
+        int err = lfs_dir_splitsearch(lfs, source, attrs, attrcount,
+                begin, end, limit, &size, &split);
+#else
         int err = lfs_dir_traverse(lfs,
                 source, 0, 0xffffffff, attrs, attrcount,
                 LFS_MKTAG(0x400, 0x3ff, 0),
                 LFS_MKTAG(LFS_TYPE_NAME, 0, 0),
                 begin, end, -begin,
                 lfs_dir_commit_size, &size);
+#endif
         if (err) {
             return err;
         }
 
-        // space is complicated, we need room for tail, crc, gstate,
-        // cleanup delete, and we cap at half a block to give room
-        // for metadata updates.
-        if (end - begin < 0xff &&
-                size <= lfs_min(lfs->cfg->block_size - 36,
-                    lfs_alignup(lfs->cfg->block_size/2,
-                        lfs->cfg->prog_size))) {
+        if (end - begin < 0xff && size <= limit) {
             break;
         }
 
+#ifndef LFS_SPLIT_SEARCH
         // can't fit, need to split, we should really be finding the
         // largest size that fits with a small binary search, but right now
-        // it's not worth the code size
+        // it's not worth the code size, see LFS_SPLIT_SEARCH
         uint16_t split = (end - begin) / 2;
+#endif
         err = lfs_dir_split(lfs, dir, attrs, attrcount,
                 source, begin+split, end);
         if (err) {
@@ -1611,6 +2794,10 @@ static int lfs_dir_compact(lfs_t *lfs,
         }
 
         end = begin + split;
+#ifdef LFS_SPLIT_SEARCH
+        // we already know what's left fits
+        break;
+#endif
     }
 
     // increment revision count
@@ -1770,6 +2957,7 @@ static int lfs_dir_compact(lfs_t *lfs,
             dir->count = end - begin;
             dir->off = commit.off;
             dir->etag = commit.ptag;
+            lfs_vcache_put(lfs, dir->pair[0], dir->rev, dir->off);
             // update gstate
             lfs->gdelta = (lfs_gstate_t){0};
             if (!relocated) {
@@ -1779,6 +2967,12 @@ static int lfs_dir_compact(lfs_t *lfs,
         break;
 
 relocate:
+        // if the old block is only worn, not bad, it can be reused once
+        // nothing references it
+        if (!relocated) {
+            worn = tired;
+        }
+
         // commit was corrupted, drop caches and prepare to relocate block
         relocated = true;
         lfs_cache_drop(lfs, &lfs->pcache);
@@ -1793,6 +2987,10 @@ relocate:
             return LFS_ERR_NOSPC;
         }
 
+        if (!tired) {
+            lfs_alloc_bad(lfs);
+        }
+
         // relocate half of pair
         int err = lfs_alloc(lfs, &dir->pair[1]);
         if (err && (err != LFS_ERR_NOSPC || !tired)) {
@@ -1812,6 +3010,11 @@ relocate:
         if (err) {
             return err;
         }
+
+        if (worn && oldpair[1] != dir->pair[0] &&
+                oldpair[1] != dir->pair[1]) {
+            lfs_alloc_release(lfs, oldpair[1]);
+        }
     }
 
     return 0;
@@ -1821,6 +3024,28 @@ relocate:
 #ifndef LFS_READONLY
 static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         const struct lfs_mattr *attrs, int attrcount) {
+    // a checkpoint is stale once anything else is written, this is usually
+    // already dropped by lfs_fs_forceconsistency
+    if (lfs->checkpointed) {
+        int err = lfs_fs_dropcheckpoint(lfs, dir);
+        if (err) {
+            return err;
+        }
+    }
+
+    // updates held by a transaction on this pair go first, the ids in them
+    // would be stale after this commit
+    if (lfs->txn && lfs->txn->count > 0 &&
+            lfs_pair_cmp(lfs->txn->pair, dir->pair) == 0) {
+        lfs_txn_t *txn = lfs->txn;
+        lfs->txn = NULL;
+        int err = lfs_txn_flush(lfs, txn, dir);
+        lfs->txn = txn;
+        if (err) {
+            return err;
+        }
+    }
+
     // check for any inline files that aren't RAM backed and
     // forcefully evict them, needed for filesystem consistency
     for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
@@ -1839,6 +3064,13 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         }
     }
 
+    // lookups through this pair are about to go stale
+    lfs_dcache_drop(lfs, dir->pair);
+    lfs_dindex_drop(lfs, dir->pair);
+    lfs_mcache_drop(lfs, dir->pair[0]);
+    lfs_vcache_drop(lfs, dir->pair[0]);
+    lfs_gstate_t gdisk = lfs->gdisk;
+
     // calculate changes to the directory
     lfs_mdir_t olddir = *dir;
     bool hasdelete = false;
@@ -1943,6 +3175,7 @@ static int lfs_dir_commit(lfs_t *lfs, lfs_mdir_t *dir,
         LFS_ASSERT(commit.off % lfs->cfg->prog_size == 0);
         dir->off = commit.off;
         dir->etag = commit.ptag;
+        lfs_vcache_put(lfs, dir->pair[0], dir->rev, dir->off);
         // and update gstate
         lfs->gdisk = lfs->gstate;
         lfs->gdelta = (lfs_gstate_t){0};
@@ -1996,7 +3229,7 @@ compact:
             while (d->id >= d->m.count && d->m.split) {
                 // we split and id is on tail now
                 d->id -= d->m.count;
-                int err = lfs_dir_fetch(lfs, &d->m, d->m.tail);
+                int err = lfs_dir_fetch(lfs, &lfs->rcache, &d->m, d->m.tail);
                 if (err) {
                     return err;
                 }
@@ -2004,6 +3237,21 @@ compact:
         }
     }
 
+    // we may have relocated, and a pending move hides entries from
+    // lookups in whatever pair it is in
+    lfs_dcache_drop(lfs, dir->pair);
+    lfs_dindex_drop(lfs, dir->pair);
+    if (dir->erased) {
+        // compacting leaves erased unset even though a fetch would find
+        // the block erased, leave such pairs to the next fetch so we don't
+        // compact again for nothing
+        lfs_mcache_put(lfs, dir);
+    }
+    if (memcmp(&gdisk, &lfs->gdisk, sizeof(gdisk)) != 0 &&
+            (lfs_gstate_hasmove(&gdisk) || lfs_gstate_hasmove(&lfs->gdisk))) {
+        lfs_dcache_reset(lfs);
+    }
+
     return 0;
 }
 #endif
@@ -2021,7 +3269,7 @@ static int lfs_rawmkdir(lfs_t *lfs, const char *path) {
     struct lfs_mlist cwd;
     cwd.next = lfs->mlist;
     uint16_t id;
-    err = lfs_dir_find(lfs, &cwd.m, &path, &id);
+    err = lfs_dir_find(lfs, &lfs->rcache, &cwd.m, &path, &id);
     if (!(err == LFS_ERR_NOENT && id != 0x3ff)) {
         return (err < 0) ? err : LFS_ERR_EXIST;
     }
@@ -2043,7 +3291,7 @@ static int lfs_rawmkdir(lfs_t *lfs, const char *path) {
     // find end of list
     lfs_mdir_t pred = cwd.m;
     while (pred.split) {
-        err = lfs_dir_fetch(lfs, &pred, pred.tail);
+        err = lfs_dir_fetch(lfs, &lfs->rcache, &pred, pred.tail);
         if (err) {
             return err;
         }
@@ -2101,14 +3349,33 @@ static int lfs_rawmkdir(lfs_t *lfs, const char *path) {
 }
 #endif
 
+static lfs_cache_t *lfs_dir_rcache(lfs_t *lfs, lfs_dir_t *dir) {
+    return (dir->cache.buffer) ? &dir->cache : &lfs->rcache;
+}
+
 static int lfs_dir_rawopen(lfs_t *lfs, lfs_dir_t *dir, const char *path) {
-    lfs_stag_t tag = lfs_dir_find(lfs, &dir->m, &path, NULL);
+    // allocate a read cache if requested
+    int err;
+    dir->cache.buffer = NULL;
+    if (lfs->cfg->dir_caches) {
+        dir->cache.buffer = lfs_malloc(lfs->cfg->cache_size);
+        if (!dir->cache.buffer) {
+            return LFS_ERR_NOMEM;
+        }
+
+        lfs_cache_drop(lfs, &dir->cache);
+    }
+
+    lfs_stag_t tag = lfs_dir_find(lfs, lfs_dir_rcache(lfs, dir),
+            &dir->m, &path, NULL);
     if (tag < 0) {
-        return tag;
+        err = tag;
+        goto cleanup;
     }
 
     if (lfs_tag_type3(tag) != LFS_TYPE_DIR) {
-        return LFS_ERR_NOTDIR;
+        err = LFS_ERR_NOTDIR;
+        goto cleanup;
     }
 
     lfs_block_t pair[2];
@@ -2118,18 +3385,20 @@ static int lfs_dir_rawopen(lfs_t *lfs, lfs_dir_t *dir, const char *path) {
         pair[1] = lfs->root[1];
     } else {
         // get dir pair from parent
-        lfs_stag_t res = lfs_dir_get(lfs, &dir->m, LFS_MKTAG(0x700, 0x3ff, 0),
+        lfs_stag_t res = lfs_dir_get(lfs, lfs_dir_rcache(lfs, dir), &dir->m,
+                LFS_MKTAG(0x700, 0x3ff, 0),
                 LFS_MKTAG(LFS_TYPE_STRUCT, lfs_tag_id(tag), 8), pair);
         if (res < 0) {
-            return res;
+            err = res;
+            goto cleanup;
         }
         lfs_pair_fromle32(pair);
     }
 
     // fetch first pair
-    int err = lfs_dir_fetch(lfs, &dir->m, pair);
+    err = lfs_dir_fetch(lfs, lfs_dir_rcache(lfs, dir), &dir->m, pair);
     if (err) {
-        return err;
+        goto cleanup;
     }
 
     // setup entry
@@ -2143,12 +3412,19 @@ static int lfs_dir_rawopen(lfs_t *lfs, lfs_dir_t *dir, const char *path) {
     lfs_mlist_append(lfs, (struct lfs_mlist *)dir);
 
     return 0;
+
+cleanup:
+    lfs_free(dir->cache.buffer);
+    return err;
 }
 
 static int lfs_dir_rawclose(lfs_t *lfs, lfs_dir_t *dir) {
     // remove from list of mdirs
     lfs_mlist_remove(lfs, (struct lfs_mlist *)dir);
 
+    // clean up memory
+    lfs_free(dir->cache.buffer);
+
     return 0;
 }
 
@@ -2174,7 +3450,8 @@ static int lfs_dir_rawread(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
                 return false;
             }
 
-            int err = lfs_dir_fetch(lfs, &dir->m, dir->m.tail);
+            int err = lfs_dir_fetch(lfs, lfs_dir_rcache(lfs, dir),
+                    &dir->m, dir->m.tail);
             if (err) {
                 return err;
             }
@@ -2182,7 +3459,8 @@ static int lfs_dir_rawread(lfs_t *lfs, lfs_dir_t *dir, struct lfs_info *info) {
             dir->id = 0;
         }
 
-        int err = lfs_dir_getinfo(lfs, &dir->m, dir->id, info);
+        int err = lfs_dir_getinfo(lfs, lfs_dir_rcache(lfs, dir),
+                &dir->m, dir->id, info);
         if (err && err != LFS_ERR_NOENT) {
             return err;
         }
@@ -2222,7 +3500,8 @@ static int lfs_dir_rawseek(lfs_t *lfs, lfs_dir_t *dir, lfs_off_t off) {
                 return LFS_ERR_INVAL;
             }
 
-            err = lfs_dir_fetch(lfs, &dir->m, dir->m.tail);
+            err = lfs_dir_fetch(lfs, lfs_dir_rcache(lfs, dir),
+                    &dir->m, dir->m.tail);
             if (err) {
                 return err;
             }
@@ -2241,7 +3520,8 @@ static lfs_soff_t lfs_dir_rawtell(lfs_t *lfs, lfs_dir_t *dir) {
 
 static int lfs_dir_rawrewind(lfs_t *lfs, lfs_dir_t *dir) {
     // reload the head dir
-    int err = lfs_dir_fetch(lfs, &dir->m, dir->head);
+    int err = lfs_dir_fetch(lfs, lfs_dir_rcache(lfs, dir),
+            &dir->m, dir->head);
     if (err) {
         return err;
     }
@@ -2266,18 +3546,56 @@ static int lfs_ctz_index(lfs_t *lfs, lfs_off_t *off) {
     return i;
 }
 
-static int lfs_ctz_find(lfs_t *lfs,
-        const lfs_cache_t *pcache, lfs_cache_t *rcache,
-        lfs_block_t head, lfs_size_t size,
-        lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
-    if (size == 0) {
-        *block = LFS_BLOCK_NULL;
-        *off = 0;
-        return 0;
+static void lfs_ctzcache_reset(struct lfs_ctzcache *ccache,
+        lfs_block_t head, lfs_off_t index) {
+    // checkpoints are spread evenly over the blocks of the list
+    ccache->head = head;
+    ccache->width = index/ccache->count + 1;
+    for (lfs_size_t i = 0; i < ccache->count; i++) {
+        ccache->points[i].block = LFS_BLOCK_NULL;
     }
+}
 
-    lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
-    lfs_off_t target = lfs_ctz_index(lfs, &pos);
+static struct lfs_ctzpoint *lfs_ctzcache_get(struct lfs_ctzcache *ccache,
+        lfs_off_t index) {
+    return &ccache->points[lfs_min(index/ccache->width, ccache->count-1)];
+}
+
+#ifndef LFS_READONLY
+static void lfs_ctzcache_drop(struct lfs_ctzcache *ccache, lfs_off_t index) {
+    // blocks from index onwards are being replaced
+    for (lfs_size_t i = 0; i < ccache->count; i++) {
+        if (ccache->points[i].index >= index) {
+            ccache->points[i].block = LFS_BLOCK_NULL;
+        }
+    }
+}
+#endif
+
+static int lfs_ctz_walk(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        struct lfs_ctzcache *ccache,
+        lfs_block_t head, lfs_off_t current,
+        lfs_off_t target, lfs_block_t *block) {
+    if (ccache && ccache->count) {
+        // checkpoints are only valid for the list they were found in
+        if (ccache->head != head) {
+            lfs_ctzcache_reset(ccache, head, current);
+        }
+
+        // start from the nearest checkpoint at or after our target, this
+        // is either in the target's slot or the one after it
+        struct lfs_ctzpoint *point = lfs_ctzcache_get(ccache, target);
+        for (int i = 0; i < 2 && point < &ccache->points[ccache->count];
+                i++, point++) {
+            if (point->block != LFS_BLOCK_NULL &&
+                    point->index >= target && point->index <= current) {
+                current = point->index;
+                head = point->block;
+                break;
+            }
+        }
+    }
 
     while (current > target) {
         lfs_size_t skip = lfs_min(
@@ -2293,9 +3611,38 @@ static int lfs_ctz_find(lfs_t *lfs,
         }
 
         current -= 1 << skip;
+
+        if (ccache && ccache->count) {
+            // remember where we've been
+            struct lfs_ctzpoint *point = lfs_ctzcache_get(ccache, current);
+            point->index = current;
+            point->block = head;
+        }
     }
 
     *block = head;
+    return 0;
+}
+
+static int lfs_ctz_find(lfs_t *lfs,
+        const lfs_cache_t *pcache, lfs_cache_t *rcache,
+        struct lfs_ctzcache *ccache,
+        lfs_block_t head, lfs_size_t size,
+        lfs_size_t pos, lfs_block_t *block, lfs_off_t *off) {
+    if (size == 0) {
+        *block = LFS_BLOCK_NULL;
+        *off = 0;
+        return 0;
+    }
+
+    lfs_off_t current = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
+    lfs_off_t target = lfs_ctz_index(lfs, &pos);
+    int err = lfs_ctz_walk(lfs, pcache, rcache, ccache,
+            head, current, target, block);
+    if (err) {
+        return err;
+    }
+
     *off = pos;
     return 0;
 }
@@ -2393,6 +3740,7 @@ static int lfs_ctz_extend(lfs_t *lfs,
 
 relocate:
         LFS_DEBUG("Bad block at 0x%"PRIx32, nblock);
+        lfs_alloc_bad(lfs);
 
         // just clear cache and try a new block
         lfs_cache_drop(lfs, pcache);
@@ -2443,33 +3791,394 @@ static int lfs_ctz_traverse(lfs_t *lfs,
     }
 }
 
-
-/// Top level file operations ///
-static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
-        const char *path, int flags,
-        const struct lfs_file_config *cfg) {
 #ifndef LFS_READONLY
-    // deorphan if we haven't yet, needed at most once after poweron
-    if ((flags & LFS_O_WRONLY) == LFS_O_WRONLY) {
-        int err = lfs_fs_forceconsistency(lfs);
-        if (err) {
-            return err;
+// return the blocks of a committed ctz list that are not shared with the
+// lists we keep to the allocator, two lists share everything below the
+// first block that matches
+static void lfs_ctz_release(lfs_t *lfs,
+        lfs_block_t head, lfs_size_t size,
+        const struct lfs_ctz *keep, int keepcount) {
+    if (size == 0) {
+        return;
+    }
+
+    LFS_ASSERT(keepcount <= 2);
+    lfs_block_t kheads[2];
+    lfs_off_t kindices[2];
+    for (int k = 0; k < keepcount; k++) {
+        kheads[k] = keep[k].head;
+        kindices[k] = 0;
+        if (keep[k].size > 0) {
+            kindices[k] = lfs_ctz_index(lfs, &(lfs_off_t){keep[k].size-1});
         }
     }
-#else
-    LFS_ASSERT((flags & LFS_O_RDONLY) == LFS_O_RDONLY);
-#endif
 
-    // setup simple file details
-    int err;
-    file->cfg = cfg;
-    file->flags = flags;
-    file->pos = 0;
+    lfs_off_t index = lfs_ctz_index(lfs, &(lfs_off_t){size-1});
+    while (true) {
+        for (int k = 0; k < keepcount; k++) {
+            if (keep[k].size == 0) {
+                continue;
+            }
+
+            while (kindices[k] > index) {
+                int err = lfs_bd_read(lfs,
+                        NULL, &lfs->rcache, sizeof(kheads[k]),
+                        kheads[k], 0, &kheads[k], sizeof(kheads[k]));
+                if (err) {
+                    // anything we miss is found by the next traversal
+                    return;
+                }
+                kheads[k] = lfs_fromle32(kheads[k]);
+                kindices[k] -= 1;
+            }
+
+            if (kindices[k] == index && kheads[k] == head) {
+                return;
+            }
+        }
+
+        lfs_alloc_release(lfs, head);
+        if (index == 0) {
+            return;
+        }
+
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, sizeof(head),
+                head, 0, &head, sizeof(head));
+        if (err) {
+            return;
+        }
+        head = lfs_fromle32(head);
+        index -= 1;
+    }
+}
+#endif
+
+
+/// Transactions ///
+#ifndef LFS_READONLY
+static int lfs_txn_rawbegin(lfs_t *lfs, lfs_txn_t *txn,
+        const struct lfs_txn_config *cfg) {
+    LFS_ASSERT(!lfs->txn);
+    txn->cfg = cfg;
+    txn->pair[0] = LFS_BLOCK_NULL;
+    txn->pair[1] = LFS_BLOCK_NULL;
+    txn->count = 0;
+    txn->off = 0;
+
+    // allocate buffer if needed
+    if (txn->cfg->buffer) {
+        txn->buffer = txn->cfg->buffer;
+    } else {
+        txn->buffer = lfs_malloc(txn->cfg->buffer_size);
+        if (!txn->buffer) {
+            return LFS_ERR_NOMEM;
+        }
+    }
+
+    lfs->txn = txn;
+    return 0;
+}
+
+static int lfs_txn_rawcommit(lfs_t *lfs, lfs_txn_t *txn) {
+    LFS_ASSERT(lfs->txn == txn);
+    lfs->txn = NULL;
+
+    int err = 0;
+    if (txn->count > 0) {
+        lfs_mdir_t dir;
+        err = lfs_dir_fetch(lfs, &lfs->rcache, &dir, txn->pair);
+        if (!err) {
+            err = lfs_txn_flush(lfs, txn, &dir);
+        }
+    }
+
+    // clean up memory
+    if (!txn->cfg->buffer) {
+        lfs_free(txn->buffer);
+    }
+
+    return err;
+}
+
+static lfs_size_t lfs_txn_dsize(lfs_tag_t tag) {
+    return lfs_tag_isdelete(tag) ? 0 : lfs_tag_size(tag);
+}
+
+// held ctz structs keep the ctz list they replace behind them
+static lfs_size_t lfs_txn_hsize(lfs_tag_t tag) {
+    return lfs_txn_dsize(tag) + ((lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT)
+            ? sizeof(struct lfs_ctz) : 0);
+}
+
+static bool lfs_txn_supersedes(const struct lfs_mattr *attrs, int attrcount,
+        lfs_tag_t tag) {
+    for (int i = 0; i < attrcount; i++) {
+        if (lfs_tag_type3(attrs[i].tag) == LFS_FROM_USERATTRS) {
+            const struct lfs_attr *a = attrs[i].buffer;
+            for (unsigned j = 0; j < lfs_tag_size(attrs[i].tag); j++) {
+                if (lfs_dir_traverse_key(tag) == lfs_dir_traverse_key(
+                        LFS_MKTAG(LFS_TYPE_USERATTR + a[j].type,
+                            lfs_tag_id(attrs[i].tag), 0))) {
+                    return true;
+                }
+            }
+        } else if (lfs_dir_traverse_key(tag) ==
+                lfs_dir_traverse_key(attrs[i].tag)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void lfs_txn_hold(lfs_txn_t *txn, lfs_tag_t tag, const void *buffer) {
+    // attrs grow up from the start of the buffer, copies of their data
+    // grow down from the end
+    struct lfs_mattr *attrs = txn->buffer;
+    txn->off += lfs_txn_hsize(tag);
+    uint8_t *data = (uint8_t*)txn->buffer + txn->cfg->buffer_size - txn->off;
+    memcpy(data, buffer, lfs_txn_dsize(tag));
+    if (lfs_tag_type3(tag) == LFS_TYPE_CTZSTRUCT) {
+        memcpy(data + lfs_txn_dsize(tag),
+                &(struct lfs_ctz){.head = LFS_BLOCK_NULL, .size = 0},
+                sizeof(struct lfs_ctz));
+    }
+    attrs[txn->count].tag = tag;
+    attrs[txn->count].buffer = data;
+    txn->count += 1;
+}
+
+static int lfs_txn_push(lfs_txn_t *txn, const lfs_mdir_t *dir,
+        const struct lfs_mattr *attrs, int attrcount) {
+    if (txn->count > 0 && lfs_pair_cmp(txn->pair, dir->pair) != 0) {
+        // not our metadata pair
+        return false;
+    }
+
+    // make sure everything fits before holding anything, counting
+    // what we already hold for the same ids as free
+    struct lfs_mattr *held = txn->buffer;
+    lfs_size_t count = txn->count;
+    lfs_size_t size = txn->off;
+    for (lfs_size_t i = 0; i < txn->count; i++) {
+        if (lfs_txn_supersedes(attrs, attrcount, held[i].tag)) {
+            count -= 1;
+            size -= lfs_txn_hsize(held[i].tag);
+        }
+    }
+
+    for (int i = 0; i < attrcount; i++) {
+        if (lfs_tag_type3(attrs[i].tag) == LFS_FROM_USERATTRS) {
+            const struct lfs_attr *a = attrs[i].buffer;
+            for (unsigned j = 0; j < lfs_tag_size(attrs[i].tag); j++) {
+                count += 1;
+                size += a[j].size;
+            }
+        } else {
+            count += 1;
+            size += lfs_txn_hsize(attrs[i].tag);
+        }
+    }
+
+    if (count*sizeof(struct lfs_mattr) + size > txn->cfg->buffer_size) {
+        return LFS_ERR_NOMEM;
+    }
+
+    // drop superseded attrs, sliding the data of the rest up to the end
+    // of the buffer, data only ever moves up so this is safe in order
+    lfs_size_t n = 0;
+    lfs_size_t off = 0;
+    for (lfs_size_t i = 0; i < txn->count; i++) {
+        if (lfs_txn_supersedes(attrs, attrcount, held[i].tag)) {
+            continue;
+        }
+
+        off += lfs_txn_hsize(held[i].tag);
+        uint8_t *data = (uint8_t*)txn->buffer + txn->cfg->buffer_size - off;
+        memmove(data, held[i].buffer, lfs_txn_hsize(held[i].tag));
+        held[n].tag = held[i].tag;
+        held[n].buffer = data;
+        n += 1;
+    }
+    txn->count = n;
+    txn->off = off;
+
+    txn->pair[0] = dir->pair[0];
+    txn->pair[1] = dir->pair[1];
+    for (int i = 0; i < attrcount; i++) {
+        if (lfs_tag_type3(attrs[i].tag) == LFS_FROM_USERATTRS) {
+            const struct lfs_attr *a = attrs[i].buffer;
+            for (unsigned j = 0; j < lfs_tag_size(attrs[i].tag); j++) {
+                lfs_txn_hold(txn, LFS_MKTAG(LFS_TYPE_USERATTR + a[j].type,
+                        lfs_tag_id(attrs[i].tag), a[j].size), a[j].buffer);
+            }
+        } else {
+            lfs_txn_hold(txn, attrs[i].tag, attrs[i].buffer);
+        }
+    }
+
+    return true;
+}
+
+// find the held ctz struct of a file, if any
+static uint8_t *lfs_txn_heldctz(lfs_txn_t *txn, const lfs_block_t pair[2],
+        uint16_t id) {
+    if (txn->count == 0 || lfs_pair_cmp(txn->pair, pair) != 0) {
+        return NULL;
+    }
+
+    const struct lfs_mattr *attrs = txn->buffer;
+    for (lfs_size_t i = 0; i < txn->count; i++) {
+        if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_CTZSTRUCT &&
+                lfs_tag_id(attrs[i].tag) == id) {
+            return (uint8_t*)attrs[i].buffer;
+        }
+    }
+
+    return NULL;
+}
+
+static int lfs_txn_flush(lfs_t *lfs, lfs_txn_t *txn, lfs_mdir_t *dir) {
+    int err = lfs_dir_commit(lfs, dir, txn->buffer, txn->count);
+    if (err) {
+        return err;
+    }
+
+    // blocks of the replaced ctz lists the held ones don't share can go
+    // back to the allocator, unless an open file may still be using them
+    const struct lfs_mattr *attrs = txn->buffer;
+    for (lfs_size_t i = 0; i < txn->count; i++) {
+        if (lfs_tag_type3(attrs[i].tag) != LFS_TYPE_CTZSTRUCT) {
+            continue;
+        }
+
+        struct lfs_ctz ctz;
+        memcpy(&ctz, attrs[i].buffer, sizeof(ctz));
+        lfs_ctz_fromle32(&ctz);
+        struct lfs_ctz octz;
+        memcpy(&octz, (const uint8_t*)attrs[i].buffer + sizeof(ctz),
+                sizeof(octz));
+
+        bool used = false;
+        for (lfs_file_t *f = (lfs_file_t*)lfs->mlist; f; f = f->next) {
+            if (f->type == LFS_TYPE_REG &&
+                    f->id == lfs_tag_id(attrs[i].tag) &&
+                    lfs_pair_cmp(f->m.pair, txn->pair) == 0 &&
+                    ((f->flags & (LFS_F_DIRTY | LFS_F_WRITING)) ||
+                        f->ctz.head != ctz.head)) {
+                used = true;
+            }
+        }
+
+        if (!used) {
+            lfs_ctz_release(lfs, octz.head, octz.size, &ctz, 1);
+        }
+    }
+
+    txn->count = 0;
+    txn->off = 0;
+    return 0;
+}
+
+// commit what a transaction holds for a metadata pair, anything that looks
+// up or moves the entries held updates are for needs them on disk first,
+// returns true if anything was committed, in which case lookups into the
+// pair need to be redone
+static int lfs_txn_flushpair(lfs_t *lfs, const lfs_block_t pair[2]) {
+    lfs_txn_t *txn = lfs->txn;
+    if (!txn || txn->count == 0 || lfs_pair_cmp(txn->pair, pair) != 0) {
+        return false;
+    }
+
+    lfs_mdir_t dir;
+    int err = lfs_dir_fetch(lfs, &lfs->rcache, &dir, txn->pair);
+    if (err) {
+        return err;
+    }
+
+    lfs->txn = NULL;
+    err = lfs_txn_flush(lfs, txn, &dir);
+    lfs->txn = txn;
+    if (err) {
+        return err;
+    }
+
+    return true;
+}
+
+static int lfs_txn_traverse(lfs_t *lfs, lfs_txn_t *txn,
+        int (*cb)(void *data, lfs_block_t block), void *data) {
+    // blocks of held files aren't on disk yet
+    const struct lfs_mattr *attrs = txn->buffer;
+    for (lfs_size_t i = 0; i < txn->count; i++) {
+        if (lfs_tag_type3(attrs[i].tag) == LFS_TYPE_CTZSTRUCT) {
+            struct lfs_ctz ctz;
+            memcpy(&ctz, attrs[i].buffer, sizeof(ctz));
+            lfs_ctz_fromle32(&ctz);
+            int err = lfs_ctz_traverse(lfs, NULL, &lfs->rcache,
+                    ctz.head, ctz.size, cb, data);
+            if (err) {
+                return err;
+            }
+        }
+    }
+
+    return 0;
+}
+#endif
+
+
+/// Top level file operations ///
+static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
+        const char *path, int flags,
+        const struct lfs_file_config *cfg) {
+#ifndef LFS_READONLY
+    // deorphan if we haven't yet, needed at most once after poweron
+    if ((flags & LFS_O_WRONLY) == LFS_O_WRONLY) {
+        int err = lfs_fs_forceconsistency(lfs);
+        if (err) {
+            return err;
+        }
+    }
+#else
+    LFS_ASSERT((flags & LFS_O_RDONLY) == LFS_O_RDONLY);
+#endif
+
+    // setup simple file details
+    int err;
+    file->cfg = cfg;
+    file->flags = flags;
+    file->pos = 0;
     file->off = 0;
     file->cache.buffer = NULL;
+    file->ccache.count = 0;
+    file->ccache.points = NULL;
+    file->ahead.size = 0;
+    file->ahead.count = 0;
+    file->ahead.blocks = NULL;
+    file->unsynced = 0;
+
+    // allocate buffer if needed, nothing to clean up yet
+    if (file->cfg->buffer) {
+        file->cache.buffer = file->cfg->buffer;
+    } else {
+        file->cache.buffer = lfs_malloc(lfs->cfg->cache_size);
+        if (!file->cache.buffer) {
+            return LFS_ERR_NOMEM;
+        }
+    }
+
+    // with per-handle caches our lookup doesn't need the shared read cache,
+    // our buffer is free until we know what's on disk
+    lfs_cache_t *rcache = &lfs->rcache;
+    if (lfs->cfg->dir_caches) {
+        lfs_cache_drop(lfs, &file->cache);
+        rcache = &file->cache;
+    }
 
     // allocate entry for file if it doesn't exist
-    lfs_stag_t tag = lfs_dir_find(lfs, &file->m, &path, &file->id);
+    lfs_stag_t tag = lfs_dir_find(lfs, rcache, &file->m, &path, &file->id);
     if (tag < 0 && !(tag == LFS_ERR_NOENT && file->id != 0x3ff)) {
         err = tag;
         goto cleanup;
@@ -2523,7 +4232,8 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
 #endif
     } else {
         // try to load what's on disk, if it's inlined we'll fix it later
-        tag = lfs_dir_get(lfs, &file->m, LFS_MKTAG(0x700, 0x3ff, 0),
+        tag = lfs_dir_get(lfs, rcache, &file->m,
+                LFS_MKTAG(0x700, 0x3ff, 0),
                 LFS_MKTAG(LFS_TYPE_STRUCT, file->id, 8), &file->ctz);
         if (tag < 0) {
             err = tag;
@@ -2536,7 +4246,7 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
     for (unsigned i = 0; i < file->cfg->attr_count; i++) {
         // if opened for read / read-write operations
         if ((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY) {
-            lfs_stag_t res = lfs_dir_get(lfs, &file->m,
+            lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &file->m,
                     LFS_MKTAG(0x7ff, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_USERATTR + file->cfg->attrs[i].type,
                         file->id, file->cfg->attrs[i].size),
@@ -2560,19 +4270,32 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
 #endif
     }
 
-    // allocate buffer if needed
-    if (file->cfg->buffer) {
-        file->cache.buffer = file->cfg->buffer;
-    } else {
-        file->cache.buffer = lfs_malloc(lfs->cfg->cache_size);
-        if (!file->cache.buffer) {
+    // zero to avoid information leak
+    lfs_cache_zero(lfs, &file->cache);
+
+    // allocate skip-list checkpoints if requested
+    if (lfs->cfg->ctz_cache_count) {
+        file->ccache.points = lfs_malloc(
+                lfs->cfg->ctz_cache_count*sizeof(struct lfs_ctzpoint));
+        if (!file->ccache.points) {
             err = LFS_ERR_NOMEM;
             goto cleanup;
         }
+
+        file->ccache.count = lfs->cfg->ctz_cache_count;
+        lfs_ctzcache_reset(&file->ccache, LFS_BLOCK_NULL, 0);
     }
 
-    // zero to avoid information leak
-    lfs_cache_zero(lfs, &file->cache);
+    if (lfs->cfg->readahead_count) {
+        file->ahead.blocks = lfs_malloc(
+                lfs->cfg->readahead_count*sizeof(lfs_block_t));
+        if (!file->ahead.blocks) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        file->ahead.count = lfs->cfg->readahead_count;
+    }
 
     if (lfs_tag_type3(tag) == LFS_TYPE_INLINESTRUCT) {
         // load inline files
@@ -2585,7 +4308,7 @@ static int lfs_file_rawopencfg(lfs_t *lfs, lfs_file_t *file,
 
         // don't always read (may be new/trunc file)
         if (file->ctz.size > 0) {
-            lfs_stag_t res = lfs_dir_get(lfs, &file->m,
+            lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &file->m,
                     LFS_MKTAG(0x700, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_STRUCT, file->id,
                         lfs_min(file->cache.size, 0x3fe)),
@@ -2630,6 +4353,9 @@ static int lfs_file_rawclose(lfs_t *lfs, lfs_file_t *file) {
         lfs_free(file->cache.buffer);
     }
 
+    lfs_free(file->ccache.points);
+    lfs_free(file->ahead.blocks);
+
     return err;
 }
 
@@ -2698,6 +4424,7 @@ static int lfs_file_relocate(lfs_t *lfs, lfs_file_t *file) {
 
 relocate:
         LFS_DEBUG("Bad block at 0x%"PRIx32, nblock);
+        lfs_alloc_bad(lfs);
 
         // just clear cache and try a new block
         lfs_cache_drop(lfs, &lfs->pcache);
@@ -2719,6 +4446,31 @@ static int lfs_file_outline(lfs_t *lfs, lfs_file_t *file) {
 }
 #endif
 
+#ifndef LFS_READONLY
+// write out our cache, relocating if we find a bad block
+static int lfs_file_flushcache(lfs_t *lfs, lfs_file_t *file) {
+    while (true) {
+        int err = lfs_bd_flush(lfs, &file->cache, &lfs->rcache, true);
+        if (err) {
+            if (err == LFS_ERR_CORRUPT) {
+                goto relocate;
+            }
+            return err;
+        }
+
+        return 0;
+
+relocate:
+        LFS_DEBUG("Bad block at 0x%"PRIx32, file->block);
+        lfs_alloc_bad(lfs);
+        err = lfs_file_relocate(lfs, file);
+        if (err) {
+            return err;
+        }
+    }
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file) {
     if (file->flags & LFS_F_READING) {
@@ -2743,17 +4495,45 @@ static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file) {
             lfs_cache_drop(lfs, &lfs->rcache);
 
             while (file->pos < file->ctz.size) {
-                // copy over a byte at a time, leave it up to caching
-                // to make this efficient
-                uint8_t data;
-                lfs_ssize_t res = lfs_file_rawread(lfs, &orig, &data, 1);
-                if (res < 0) {
-                    return res;
-                }
+                if (file->off < lfs->cfg->block_size &&
+                        file->cache.block == file->block &&
+                        file->off >= file->cache.off &&
+                        file->off < file->cache.off + lfs->cfg->cache_size) {
+                    // read straight into our cache where writing would
+                    // copy it to, a cache's worth at a time
+                    lfs_off_t off = file->off - file->cache.off;
+                    lfs_ssize_t res = lfs_file_rawread(lfs, &orig,
+                            &file->cache.buffer[off],
+                            lfs_min(lfs->cfg->cache_size - off, lfs_min(
+                                lfs->cfg->block_size - file->off,
+                                file->ctz.size - file->pos)));
+                    if (res < 0) {
+                        return res;
+                    }
 
-                res = lfs_file_rawwrite(lfs, file, &data, 1);
-                if (res < 0) {
-                    return res;
+                    file->pos += res;
+                    file->off += res;
+                    file->unsynced += res;
+                    file->cache.size = lfs_max(file->cache.size, off + res);
+                    if (file->cache.size == lfs->cfg->cache_size) {
+                        int err = lfs_file_flushcache(lfs, file);
+                        if (err) {
+                            return err;
+                        }
+                    }
+                } else {
+                    // otherwise let writing find our next block and set
+                    // up our cache
+                    uint8_t data;
+                    lfs_ssize_t res = lfs_file_rawread(lfs, &orig, &data, 1);
+                    if (res < 0) {
+                        return res;
+                    }
+
+                    res = lfs_file_rawwrite(lfs, file, &data, 1);
+                    if (res < 0) {
+                        return res;
+                    }
                 }
 
                 // keep our reference to the rcache in sync
@@ -2764,23 +4544,9 @@ static int lfs_file_flush(lfs_t *lfs, lfs_file_t *file) {
             }
 
             // write out what we have
-            while (true) {
-                int err = lfs_bd_flush(lfs, &file->cache, &lfs->rcache, true);
-                if (err) {
-                    if (err == LFS_ERR_CORRUPT) {
-                        goto relocate;
-                    }
-                    return err;
-                }
-
-                break;
-
-relocate:
-                LFS_DEBUG("Bad block at 0x%"PRIx32, file->block);
-                err = lfs_file_relocate(lfs, file);
-                if (err) {
-                    return err;
-                }
+            int err = lfs_file_flushcache(lfs, file);
+            if (err) {
+                return err;
             }
         } else {
             file->pos = lfs_max(file->pos, file->ctz.size);
@@ -2789,6 +4555,8 @@ relocate:
         // actual file updates
         file->ctz.head = file->block;
         file->ctz.size = file->pos;
+        file->ccache.head = file->ctz.head;
+        file->ahead.size = 0;
         file->flags &= ~LFS_F_WRITING;
         file->flags |= LFS_F_DIRTY;
 
@@ -2835,23 +4603,149 @@ static int lfs_file_rawsync(lfs_t *lfs, lfs_file_t *file) {
             size = sizeof(ctz);
         }
 
-        // commit file data and attributes
-        err = lfs_dir_commit(lfs, &file->m, LFS_MKATTRS(
-                {LFS_MKTAG(type, file->id, size), buffer},
-                {LFS_MKTAG(LFS_FROM_USERATTRS, file->id,
-                    file->cfg->attr_count), file->cfg->attrs}));
-        if (err) {
-            file->flags |= LFS_F_ERRED;
-            return err;
-        }
+        // find the ctz list we are replacing, blocks the new list doesn't
+        // share can go back to the allocator once we've committed
+        struct lfs_ctz octz = {.head = LFS_BLOCK_NULL, .size = 0};
+        bool shared = lfs_mlist_isfile(lfs, (struct lfs_mlist*)file,
+                file->m.pair, file->id);
+        if (lfs_alloc_ismap(lfs)) {
+            lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &file->m,
+                    LFS_MKTAG(0x700, 0x3ff, 0),
+                    LFS_MKTAG(LFS_TYPE_STRUCT, file->id, sizeof(octz)),
+                    &octz);
+            if (res < 0 && res != LFS_ERR_NOENT) {
+                file->flags |= LFS_F_ERRED;
+                return res;
+            }
 
-        file->flags &= ~LFS_F_DIRTY;
-    }
+            if (res < 0 || lfs_tag_type3(res) != LFS_TYPE_CTZSTRUCT) {
+                octz.size = 0;
+            }
+            lfs_ctz_fromle32(&octz);
+        }
+
+        // hold the update if we're part of a transaction
+        if (lfs->txn) {
+            // a list held by an earlier sync was never committed
+            struct lfs_ctz hctz = {.head = LFS_BLOCK_NULL, .size = 0};
+            const uint8_t *held = lfs_txn_heldctz(lfs->txn,
+                    file->m.pair, file->id);
+            if (held) {
+                memcpy(&hctz, held, sizeof(hctz));
+                lfs_ctz_fromle32(&hctz);
+            }
 
+            int res = lfs_txn_push(lfs->txn, &file->m, LFS_MKATTRS(
+                    {LFS_MKTAG(type, file->id, size), buffer},
+                    {LFS_MKTAG(LFS_FROM_USERATTRS, file->id,
+                        file->cfg->attr_count), file->cfg->attrs}));
+            if (res < 0) {
+                return res;
+            }
+
+            if (res) {
+                // committing the transaction releases the list we replace,
+                // the held list only keeps what it shares with that one and
+                // ours
+                uint8_t *data = lfs_txn_heldctz(lfs->txn,
+                        file->m.pair, file->id);
+                if (data) {
+                    memcpy(data + sizeof(struct lfs_ctz), &octz,
+                            sizeof(octz));
+                }
+
+                if (lfs_alloc_ismap(lfs) && !shared) {
+                    lfs_ctz_release(lfs, hctz.head, hctz.size,
+                            (const struct lfs_ctz[]){octz, file->ctz},
+                            (file->flags & LFS_F_INLINE) ? 1 : 2);
+                }
+
+                file->flags &= ~(LFS_F_DIRTY | LFS_F_HELD);
+                file->unsynced = 0;
+                return 0;
+            }
+        }
+
+        if (shared) {
+            octz.size = 0;
+        }
+
+        // commit file data and attributes
+        err = lfs_dir_commit(lfs, &file->m, LFS_MKATTRS(
+                {LFS_MKTAG(type, file->id, size), buffer},
+                {LFS_MKTAG(LFS_FROM_USERATTRS, file->id,
+                    file->cfg->attr_count), file->cfg->attrs}));
+        if (err) {
+            file->flags |= LFS_F_ERRED;
+            return err;
+        }
+
+        lfs_ctz_release(lfs, octz.head, octz.size,
+                &file->ctz, (file->flags & LFS_F_INLINE) ? 0 : 1);
+        file->flags &= ~LFS_F_DIRTY;
+    }
+
+    file->flags &= ~LFS_F_HELD;
+    file->unsynced = 0;
     return 0;
 }
 #endif
 
+#ifndef LFS_READONLY
+static int lfs_file_rawlazysync(lfs_t *lfs, lfs_file_t *file) {
+    // hold back small syncs, the data stays in our cache for the next
+    // writes, lfs_fs_syncheld or closing the file catches up
+    if (file->unsynced > 0 && file->unsynced < lfs->cfg->sync_size) {
+        file->flags |= LFS_F_HELD;
+        return 0;
+    }
+
+    return lfs_file_rawsync(lfs, file);
+}
+#endif
+
+static int lfs_file_readahead(lfs_t *lfs, lfs_file_t *file) {
+    struct lfs_ctzahead *ahead = &file->ahead;
+    lfs_off_t off = file->pos;
+    lfs_off_t index = lfs_ctz_index(lfs, &off);
+
+    if (ahead->head != file->ctz.head ||
+            index < ahead->index || index >= ahead->index + ahead->size) {
+        // blocks only point backwards, so find the furthest block we want
+        // and follow the first pointer of each block down to this one
+        lfs_off_t last = lfs_ctz_index(lfs, &(lfs_off_t){file->ctz.size-1});
+        lfs_size_t size = lfs_min(ahead->count, last-index + 1);
+        lfs_block_t block;
+        int err = lfs_ctz_walk(lfs, NULL, &file->cache, &file->ccache,
+                file->ctz.head, last, index+size-1, &block);
+        if (err) {
+            return err;
+        }
+
+        ahead->size = 0;
+        for (lfs_size_t i = size; i > 0; i--) {
+            ahead->blocks[i-1] = block;
+            if (i > 1) {
+                err = lfs_bd_read(lfs,
+                        NULL, &file->cache, sizeof(block),
+                        block, 0, &block, sizeof(block));
+                block = lfs_fromle32(block);
+                if (err) {
+                    return err;
+                }
+            }
+        }
+
+        ahead->head = file->ctz.head;
+        ahead->index = index;
+        ahead->size = size;
+    }
+
+    file->block = ahead->blocks[index - ahead->index];
+    file->off = off;
+    return 0;
+}
+
 static lfs_ssize_t lfs_file_rawread(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size) {
     LFS_ASSERT((file->flags & LFS_O_RDONLY) == LFS_O_RDONLY);
@@ -2882,9 +4776,15 @@ static lfs_ssize_t lfs_file_rawread(lfs_t *lfs, lfs_file_t *file,
         if (!(file->flags & LFS_F_READING) ||
                 file->off == lfs->cfg->block_size) {
             if (!(file->flags & LFS_F_INLINE)) {
-                int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                        file->ctz.head, file->ctz.size,
-                        file->pos, &file->block, &file->off);
+                int err;
+                if ((file->flags & LFS_F_READING) && file->ahead.count) {
+                    // crossed into the next block, we're reading sequentially
+                    err = lfs_file_readahead(lfs, file);
+                } else {
+                    err = lfs_ctz_find(lfs, NULL, &file->cache,
+                            &file->ccache, file->ctz.head, file->ctz.size,
+                            file->pos, &file->block, &file->off);
+                }
                 if (err) {
                     return err;
                 }
@@ -2983,7 +4883,7 @@ static lfs_ssize_t lfs_file_rawwrite(lfs_t *lfs, lfs_file_t *file,
                 if (!(file->flags & LFS_F_WRITING) && file->pos > 0) {
                     // find out which block we're extending from
                     int err = lfs_ctz_find(lfs, NULL, &file->cache,
-                            file->ctz.head, file->ctz.size,
+                            &file->ccache, file->ctz.head, file->ctz.size,
                             file->pos-1, &file->block, &file->off);
                     if (err) {
                         file->flags |= LFS_F_ERRED;
@@ -3003,6 +4903,12 @@ static lfs_ssize_t lfs_file_rawwrite(lfs_t *lfs, lfs_file_t *file,
                     file->flags |= LFS_F_ERRED;
                     return err;
                 }
+
+                // checkpoints past here are no longer part of the file
+                if (file->ccache.count) {
+                    lfs_ctzcache_drop(&file->ccache,
+                            lfs_ctz_index(lfs, &(lfs_off_t){file->pos}));
+                }
             } else {
                 file->block = LFS_BLOCK_INLINE;
                 file->off = file->pos;
@@ -3026,6 +4932,7 @@ static lfs_ssize_t lfs_file_rawwrite(lfs_t *lfs, lfs_file_t *file,
 
             break;
 relocate:
+            lfs_alloc_bad(lfs);
             err = lfs_file_relocate(lfs, file);
             if (err) {
                 file->flags |= LFS_F_ERRED;
@@ -3041,18 +4948,66 @@ relocate:
         lfs_alloc_ack(lfs);
     }
 
+    file->unsynced += size;
     file->flags &= ~LFS_F_ERRED;
     return size;
 }
 #endif
 
+// move to a new position without touching the file's cache, only valid when
+// we aren't writing
+static void lfs_file_repos(lfs_t *lfs, lfs_file_t *file, lfs_off_t pos) {
+#ifndef LFS_READONLY
+    LFS_ASSERT(!(file->flags & LFS_F_WRITING));
+#endif
+    if (file->flags & LFS_F_READING) {
+        if (file->flags & LFS_F_INLINE) {
+            file->off = pos;
+        } else {
+            // still in the same block? otherwise find it on the next read,
+            // the cache stays valid either way
+            lfs_off_t ooff = file->pos;
+            lfs_off_t noff = pos;
+            if (lfs_ctz_index(lfs, &ooff) == lfs_ctz_index(lfs, &noff) &&
+                    ooff == file->off) {
+                file->off = noff;
+            } else {
+                file->off = lfs->cfg->block_size;
+            }
+        }
+    }
+
+    file->pos = pos;
+}
+
+static lfs_ssize_t lfs_file_rawpread(lfs_t *lfs, lfs_file_t *file,
+        void *buffer, lfs_size_t size, lfs_off_t off) {
+#ifndef LFS_READONLY
+    if (file->flags & LFS_F_WRITING) {
+        // flush out any writes, they are tied to our position
+        int err = lfs_file_flush(lfs, file);
+        if (err) {
+            return err;
+        }
+    }
+#endif
+
+    lfs_off_t pos = file->pos;
+    lfs_file_repos(lfs, file, off);
+    lfs_ssize_t res = lfs_file_rawread(lfs, file, buffer, size);
+    lfs_file_repos(lfs, file, pos);
+    return res;
+}
+
 static lfs_soff_t lfs_file_rawseek(lfs_t *lfs, lfs_file_t *file,
         lfs_soff_t off, int whence) {
 #ifndef LFS_READONLY
-    // write out everything beforehand, may be noop if rdonly
-    int err = lfs_file_flush(lfs, file);
-    if (err) {
-        return err;
+    if (file->flags & LFS_F_WRITING) {
+        // write out everything beforehand, reads can keep their cache
+        int err = lfs_file_flush(lfs, file);
+        if (err) {
+            return err;
+        }
     }
 #endif
 
@@ -3072,10 +5027,34 @@ static lfs_soff_t lfs_file_rawseek(lfs_t *lfs, lfs_file_t *file,
     }
 
     // update pos
-    file->pos = npos;
+    lfs_file_repos(lfs, file, npos);
     return npos;
 }
 
+#ifndef LFS_READONLY
+static lfs_ssize_t lfs_file_rawpwrite(lfs_t *lfs, lfs_file_t *file,
+        const void *buffer, lfs_size_t size, lfs_off_t off) {
+    lfs_off_t pos = file->pos;
+    lfs_soff_t res = lfs_file_rawseek(lfs, file, off, LFS_SEEK_SET);
+    if (res < 0) {
+        return res;
+    }
+
+    lfs_ssize_t nsize = lfs_file_rawwrite(lfs, file, buffer, size);
+    if (nsize < 0) {
+        return nsize;
+    }
+
+    // writes are tied to our position, so going back writes them out
+    res = lfs_file_rawseek(lfs, file, pos, LFS_SEEK_SET);
+    if (res < 0) {
+        return res;
+    }
+
+    return nsize;
+}
+#endif
+
 #ifndef LFS_READONLY
 static int lfs_file_rawtruncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
     LFS_ASSERT((file->flags & LFS_O_WRONLY) == LFS_O_WRONLY);
@@ -3095,7 +5074,7 @@ static int lfs_file_rawtruncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
 
         // lookup new head in ctz skip list
         err = lfs_ctz_find(lfs, NULL, &file->cache,
-                file->ctz.head, file->ctz.size,
+                &file->ccache, file->ctz.head, file->ctz.size,
                 size, &file->block, &file->off);
         if (err) {
             return err;
@@ -3103,7 +5082,12 @@ static int lfs_file_rawtruncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
 
         file->ctz.head = file->block;
         file->ctz.size = size;
+        file->ccache.head = file->ctz.head;
+        file->ahead.size = 0;
         file->flags |= LFS_F_DIRTY | LFS_F_READING;
+        // our block is now the one at the new size, keep pos in sync so
+        // restoring pos can tell whether it stays there
+        file->pos = size;
     } else if (size > oldsize) {
         // flush+seek if not already at end
         if (file->pos != oldsize) {
@@ -3158,16 +5142,28 @@ static lfs_soff_t lfs_file_rawsize(lfs_t *lfs, lfs_file_t *file) {
     return file->ctz.size;
 }
 
+static bool lfs_file_rawisshared(lfs_t *lfs, lfs_file_t *file) {
+    (void)lfs;
+    // files open for writing may need to flush when read, and inline files
+    // may need to reload from their metadata pair through lfs->rcache
+#ifndef LFS_READONLY
+    if (file->flags & LFS_O_WRONLY) {
+        return false;
+    }
+#endif
+    return !(file->flags & LFS_F_INLINE);
+}
+
 
 /// General fs operations ///
 static int lfs_rawstat(lfs_t *lfs, const char *path, struct lfs_info *info) {
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+    lfs_stag_t tag = lfs_dir_find(lfs, &lfs->rcache, &cwd, &path, NULL);
     if (tag < 0) {
         return (int)tag;
     }
 
-    return lfs_dir_getinfo(lfs, &cwd, lfs_tag_id(tag), info);
+    return lfs_dir_getinfo(lfs, &lfs->rcache, &cwd, lfs_tag_id(tag), info);
 }
 
 #ifndef LFS_READONLY
@@ -3179,24 +5175,55 @@ static int lfs_rawremove(lfs_t *lfs, const char *path) {
     }
 
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
-    if (tag < 0 || lfs_tag_id(tag) == 0x3ff) {
-        return (tag < 0) ? (int)tag : LFS_ERR_INVAL;
+    lfs_stag_t tag;
+    while (true) {
+        tag = lfs_dir_find(lfs, &lfs->rcache, &cwd, &path, NULL);
+        if (tag < 0 || lfs_tag_id(tag) == 0x3ff) {
+            return (tag < 0) ? (int)tag : LFS_ERR_INVAL;
+        }
+
+        // we need any held update to what we remove on disk, otherwise
+        // we would release the wrong ctz list
+        int res = lfs_txn_flushpair(lfs, cwd.pair);
+        if (res < 0) {
+            return res;
+        }
+
+        if (!res) {
+            break;
+        }
     }
 
     struct lfs_mlist dir;
     dir.next = lfs->mlist;
-    if (lfs_tag_type3(tag) == LFS_TYPE_DIR) {
+    struct lfs_ctz ctz = {.head = LFS_BLOCK_NULL, .size = 0};
+    if (lfs_tag_type3(tag) == LFS_TYPE_REG && lfs_alloc_ismap(lfs) &&
+            !lfs_mlist_isfile(lfs, NULL, cwd.pair, lfs_tag_id(tag))) {
+        // find the file's ctz list so we can return it to the allocator
+        lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &cwd,
+                LFS_MKTAG(0x700, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_STRUCT, lfs_tag_id(tag), sizeof(ctz)),
+                &ctz);
+        if (res < 0) {
+            return (int)res;
+        }
+
+        if (lfs_tag_type3(res) != LFS_TYPE_CTZSTRUCT) {
+            ctz.size = 0;
+        }
+        lfs_ctz_fromle32(&ctz);
+    } else if (lfs_tag_type3(tag) == LFS_TYPE_DIR) {
         // must be empty before removal
         lfs_block_t pair[2];
-        lfs_stag_t res = lfs_dir_get(lfs, &cwd, LFS_MKTAG(0x700, 0x3ff, 0),
+        lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &cwd,
+                LFS_MKTAG(0x700, 0x3ff, 0),
                 LFS_MKTAG(LFS_TYPE_STRUCT, lfs_tag_id(tag), 8), pair);
         if (res < 0) {
             return (int)res;
         }
         lfs_pair_fromle32(pair);
 
-        err = lfs_dir_fetch(lfs, &dir.m, pair);
+        err = lfs_dir_fetch(lfs, &lfs->rcache, &dir.m, pair);
         if (err) {
             return err;
         }
@@ -3224,6 +5251,7 @@ static int lfs_rawremove(lfs_t *lfs, const char *path) {
     }
 
     lfs->mlist = dir.next;
+    lfs_ctz_release(lfs, ctz.head, ctz.size, NULL, 0);
     if (lfs_tag_type3(tag) == LFS_TYPE_DIR) {
         // fix orphan
         lfs_fs_preporphans(lfs, -1);
@@ -3237,6 +5265,9 @@ static int lfs_rawremove(lfs_t *lfs, const char *path) {
         if (err) {
             return err;
         }
+
+        lfs_alloc_release(lfs, dir.m.pair[0]);
+        lfs_alloc_release(lfs, dir.m.pair[1]);
     }
 
     return 0;
@@ -3251,20 +5282,43 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
         return err;
     }
 
-    // find old entry
     lfs_mdir_t oldcwd;
-    lfs_stag_t oldtag = lfs_dir_find(lfs, &oldcwd, &oldpath, NULL);
-    if (oldtag < 0 || lfs_tag_id(oldtag) == 0x3ff) {
-        return (oldtag < 0) ? (int)oldtag : LFS_ERR_INVAL;
-    }
-
-    // find new entry
+    lfs_stag_t oldtag;
     lfs_mdir_t newcwd;
     uint16_t newid;
-    lfs_stag_t prevtag = lfs_dir_find(lfs, &newcwd, &newpath, &newid);
-    if ((prevtag < 0 || lfs_tag_id(prevtag) == 0x3ff) &&
-            !(prevtag == LFS_ERR_NOENT && newid != 0x3ff)) {
-        return (prevtag < 0) ? (int)prevtag : LFS_ERR_INVAL;
+    lfs_stag_t prevtag;
+    while (true) {
+        // find old entry
+        const char *path = oldpath;
+        oldtag = lfs_dir_find(lfs, &lfs->rcache, &oldcwd, &path, NULL);
+        if (oldtag < 0 || lfs_tag_id(oldtag) == 0x3ff) {
+            return (oldtag < 0) ? (int)oldtag : LFS_ERR_INVAL;
+        }
+
+        // find new entry
+        path = newpath;
+        prevtag = lfs_dir_find(lfs, &lfs->rcache, &newcwd, &path, &newid);
+        if ((prevtag < 0 || lfs_tag_id(prevtag) == 0x3ff) &&
+                !(prevtag == LFS_ERR_NOENT && newid != 0x3ff)) {
+            return (prevtag < 0) ? (int)prevtag : LFS_ERR_INVAL;
+        }
+
+        // we need any held update to what we move or overwrite on disk,
+        // otherwise the move would copy the old contents and we would
+        // release the wrong ctz list
+        int res = lfs_txn_flushpair(lfs, oldcwd.pair);
+        if (!res) {
+            res = lfs_txn_flushpair(lfs, newcwd.pair);
+        }
+
+        if (res < 0) {
+            return res;
+        }
+
+        if (!res) {
+            newpath = path;
+            break;
+        }
     }
 
     // if we're in the same pair there's a few special cases...
@@ -3273,6 +5327,7 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
 
     struct lfs_mlist prevdir;
     prevdir.next = lfs->mlist;
+    struct lfs_ctz prevctz = {.head = LFS_BLOCK_NULL, .size = 0};
     if (prevtag == LFS_ERR_NOENT) {
         // check that name fits
         lfs_size_t nlen = strlen(newpath);
@@ -3294,7 +5349,8 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
     } else if (lfs_tag_type3(prevtag) == LFS_TYPE_DIR) {
         // must be empty before removal
         lfs_block_t prevpair[2];
-        lfs_stag_t res = lfs_dir_get(lfs, &newcwd, LFS_MKTAG(0x700, 0x3ff, 0),
+        lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &newcwd,
+                LFS_MKTAG(0x700, 0x3ff, 0),
                 LFS_MKTAG(LFS_TYPE_STRUCT, newid, 8), prevpair);
         if (res < 0) {
             return (int)res;
@@ -3302,7 +5358,7 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
         lfs_pair_fromle32(prevpair);
 
         // must be empty before removal
-        err = lfs_dir_fetch(lfs, &prevdir.m, prevpair);
+        err = lfs_dir_fetch(lfs, &lfs->rcache, &prevdir.m, prevpair);
         if (err) {
             return err;
         }
@@ -3319,6 +5375,21 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
         prevdir.type = 0;
         prevdir.id = 0;
         lfs->mlist = &prevdir;
+    } else if (lfs_alloc_ismap(lfs) &&
+            !lfs_mlist_isfile(lfs, NULL, newcwd.pair, newid)) {
+        // find the ctz list we are overwriting so we can return it to the
+        // allocator
+        lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &newcwd,
+                LFS_MKTAG(0x700, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_STRUCT, newid, sizeof(prevctz)), &prevctz);
+        if (res < 0) {
+            return (int)res;
+        }
+
+        if (lfs_tag_type3(res) != LFS_TYPE_CTZSTRUCT) {
+            prevctz.size = 0;
+        }
+        lfs_ctz_fromle32(&prevctz);
     }
 
     if (!samepair) {
@@ -3353,6 +5424,7 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
     }
 
     lfs->mlist = prevdir.next;
+    lfs_ctz_release(lfs, prevctz.head, prevctz.size, NULL, 0);
     if (prevtag != LFS_ERR_NOENT && lfs_tag_type3(prevtag) == LFS_TYPE_DIR) {
         // fix orphan
         lfs_fs_preporphans(lfs, -1);
@@ -3366,6 +5438,9 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
         if (err) {
             return err;
         }
+
+        lfs_alloc_release(lfs, prevdir.m.pair[0]);
+        lfs_alloc_release(lfs, prevdir.m.pair[1]);
     }
 
     return 0;
@@ -3375,7 +5450,7 @@ static int lfs_rawrename(lfs_t *lfs, const char *oldpath, const char *newpath) {
 static lfs_ssize_t lfs_rawgetattr(lfs_t *lfs, const char *path,
         uint8_t type, void *buffer, lfs_size_t size) {
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+    lfs_stag_t tag = lfs_dir_find(lfs, &lfs->rcache, &cwd, &path, NULL);
     if (tag < 0) {
         return tag;
     }
@@ -3384,13 +5459,13 @@ static lfs_ssize_t lfs_rawgetattr(lfs_t *lfs, const char *path,
     if (id == 0x3ff) {
         // special case for root
         id = 0;
-        int err = lfs_dir_fetch(lfs, &cwd, lfs->root);
+        int err = lfs_dir_fetch(lfs, &lfs->rcache, &cwd, lfs->root);
         if (err) {
             return err;
         }
     }
 
-    tag = lfs_dir_get(lfs, &cwd, LFS_MKTAG(0x7ff, 0x3ff, 0),
+    tag = lfs_dir_get(lfs, &lfs->rcache, &cwd, LFS_MKTAG(0x7ff, 0x3ff, 0),
             LFS_MKTAG(LFS_TYPE_USERATTR + type,
                 id, lfs_min(size, lfs->attr_max)),
             buffer);
@@ -3409,7 +5484,7 @@ static lfs_ssize_t lfs_rawgetattr(lfs_t *lfs, const char *path,
 static int lfs_commitattr(lfs_t *lfs, const char *path,
         uint8_t type, const void *buffer, lfs_size_t size) {
     lfs_mdir_t cwd;
-    lfs_stag_t tag = lfs_dir_find(lfs, &cwd, &path, NULL);
+    lfs_stag_t tag = lfs_dir_find(lfs, &lfs->rcache, &cwd, &path, NULL);
     if (tag < 0) {
         return tag;
     }
@@ -3418,7 +5493,7 @@ static int lfs_commitattr(lfs_t *lfs, const char *path,
     if (id == 0x3ff) {
         // special case for root
         id = 0;
-        int err = lfs_dir_fetch(lfs, &cwd, lfs->root);
+        int err = lfs_dir_fetch(lfs, &lfs->rcache, &cwd, lfs->root);
         if (err) {
             return err;
         }
@@ -3450,6 +5525,27 @@ static int lfs_rawremoveattr(lfs_t *lfs, const char *path, uint8_t type) {
 /// Filesystem operations ///
 static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->cfg = cfg;
+    lfs->erasing.block = LFS_BLOCK_NULL;
+    lfs->erasing.bad = LFS_BLOCK_NULL;
+    lfs->erasing.busy = false;
+    lfs->rset.ways = NULL;
+    lfs->rset.buffer = NULL;
+    lfs->pool.blocks = NULL;
+    lfs->pool.count = 0;
+    lfs->pool.size = 0;
+    lfs->split.sizes = NULL;
+    lfs->split.count = 0;
+    lfs->dcache.entries = NULL;
+    lfs->dcache.count = 0;
+    lfs->dindex.entries = NULL;
+    lfs->dindex.count = 0;
+    lfs->mcache.entries = NULL;
+    lfs->mcache.count = 0;
+    lfs->vcache.entries = NULL;
+    lfs->vcache.count = 0;
+    lfs->filter.buffer = NULL;
+    lfs->filter.size = 0;
+    lfs->filter.off = 0;
     int err = 0;
 
     // validate that the lfs-cfg sizes were initiated properly before
@@ -3464,6 +5560,9 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     LFS_ASSERT(lfs->cfg->cache_size % lfs->cfg->prog_size == 0);
     LFS_ASSERT(lfs->cfg->block_size % lfs->cfg->cache_size == 0);
 
+    // asynchronous erases need a way to wait for them
+    LFS_ASSERT(!lfs->cfg->erase_async || lfs->cfg->wait);
+
     // check that the block size is large enough to fit ctz pointers
     LFS_ASSERT(4*lfs_npw2(0xffffffff / (lfs->cfg->block_size-2*4))
             <= lfs->cfg->block_size);
@@ -3517,6 +5616,122 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
         }
     }
 
+    // setup additional read caches, associativity must be a factor of
+    // the number of caches
+    if (lfs->cfg->rcache_count) {
+        lfs->rset.count = lfs->cfg->rcache_ways;
+        if (!lfs->rset.count) {
+            lfs->rset.count = lfs->cfg->rcache_count;
+        }
+        LFS_ASSERT(lfs->cfg->rcache_count % lfs->rset.count == 0);
+        lfs->rset.sets = lfs->cfg->rcache_count / lfs->rset.count;
+        lfs->rset.age = 0;
+
+        lfs->rset.ways = lfs_malloc(
+                lfs->cfg->rcache_count*sizeof(struct lfs_rway));
+        lfs->rset.buffer = lfs_malloc(
+                lfs->cfg->rcache_count*lfs->cfg->cache_size);
+        if (!lfs->rset.ways || !lfs->rset.buffer) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        for (lfs_size_t i = 0; i < lfs->cfg->rcache_count; i++) {
+            lfs->rset.ways[i].cache.buffer =
+                    &lfs->rset.buffer[i*lfs->cfg->cache_size];
+            lfs_cache_drop(lfs, &lfs->rset.ways[i].cache);
+            lfs->rset.ways[i].age = 0;
+        }
+    }
+
+    // setup path lookup cache
+    if (lfs->cfg->dcache_count) {
+        lfs->dcache.entries = lfs_malloc(
+                lfs->cfg->dcache_count*sizeof(struct lfs_dentry));
+        if (!lfs->dcache.entries) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs->dcache.count = lfs->cfg->dcache_count;
+        lfs_dcache_reset(lfs);
+    }
+
+    // setup directory index
+    if (lfs->cfg->dindex_count) {
+        lfs->dindex.entries = lfs_malloc(
+                lfs->cfg->dindex_count*sizeof(struct lfs_dpair));
+        if (!lfs->dindex.entries) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs->dindex.count = lfs->cfg->dindex_count;
+        lfs_dindex_reset(lfs);
+    }
+
+    // setup metadata pair summaries
+    if (lfs->cfg->mcache_count) {
+        lfs->mcache.entries = lfs_malloc(
+                lfs->cfg->mcache_count*sizeof(lfs_mdir_t));
+        if (!lfs->mcache.entries) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs->mcache.count = lfs->cfg->mcache_count;
+        lfs_mcache_reset(lfs);
+    }
+
+    // setup checked commits in metadata blocks
+    if (lfs->cfg->vcache_count) {
+        lfs->vcache.entries = lfs_malloc(
+                lfs->cfg->vcache_count*sizeof(struct lfs_vblock));
+        if (!lfs->vcache.entries) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs->vcache.count = lfs->cfg->vcache_count;
+        lfs_vcache_reset(lfs);
+    }
+
+#ifndef LFS_READONLY
+    // setup filter buffer for compacting metadata pairs
+    if (lfs->cfg->filter_size) {
+        lfs->filter.buffer = lfs_malloc(lfs->cfg->filter_size);
+        if (!lfs->filter.buffer) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs->filter.size = lfs->cfg->filter_size / sizeof(uint32_t);
+    }
+
+    // setup pool of blocks erased ahead of time
+    if (lfs->cfg->erase_pool_count) {
+        lfs->pool.blocks = lfs_malloc(
+                lfs->cfg->erase_pool_count*sizeof(lfs_block_t));
+        if (!lfs->pool.blocks) {
+            err = LFS_ERR_NOMEM;
+            goto cleanup;
+        }
+
+        lfs->pool.count = lfs->cfg->erase_pool_count;
+    }
+
+#ifdef LFS_SPLIT_SEARCH
+    // setup entry sizes for finding where to split metadata pairs, every
+    // entry takes at least a tag so no more than this can be split off
+    lfs->split.count = lfs_min(0xfe, lfs->cfg->block_size/4);
+    lfs->split.sizes = lfs_malloc(lfs->split.count*sizeof(uint16_t));
+    if (!lfs->split.sizes) {
+        err = LFS_ERR_NOMEM;
+        goto cleanup;
+    }
+#endif
+#endif
+
     // check that the size limits are sane
     LFS_ASSERT(lfs->cfg->name_max <= LFS_NAME_MAX);
     lfs->name_max = lfs->cfg->name_max;
@@ -3541,9 +5756,12 @@ static int lfs_init(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->root[1] = LFS_BLOCK_NULL;
     lfs->mlist = NULL;
     lfs->seed = 0;
+    lfs->txn = NULL;
     lfs->gdisk = (lfs_gstate_t){0};
     lfs->gstate = (lfs_gstate_t){0};
     lfs->gdelta = (lfs_gstate_t){0};
+    lfs->checkpointed = false;
+    lfs->usage = -1;
 #ifdef LFS_MIGRATE
     lfs->lfs1 = NULL;
 #endif
@@ -3556,6 +5774,9 @@ cleanup:
 }
 
 static int lfs_deinit(lfs_t *lfs) {
+    // don't leave an erase running
+    int err = lfs_bd_wait(lfs);
+
     // free allocated memory
     if (!lfs->cfg->read_buffer) {
         lfs_free(lfs->rcache.buffer);
@@ -3569,7 +5790,17 @@ static int lfs_deinit(lfs_t *lfs) {
         lfs_free(lfs->free.buffer);
     }
 
-    return 0;
+    lfs_free(lfs->rset.buffer);
+    lfs_free(lfs->rset.ways);
+    lfs_free(lfs->pool.blocks);
+    lfs_free(lfs->split.sizes);
+    lfs_free(lfs->dcache.entries);
+    lfs_free(lfs->dindex.entries);
+    lfs_free(lfs->mcache.entries);
+    lfs_free(lfs->vcache.entries);
+    lfs_free(lfs->filter.buffer);
+
+    return err;
 }
 
 #ifndef LFS_READONLY
@@ -3617,7 +5848,8 @@ static int lfs_rawformat(lfs_t *lfs, const struct lfs_config *cfg) {
         }
 
         // sanity check that fetch works
-        err = lfs_dir_fetch(lfs, &root, (const lfs_block_t[2]){0, 1});
+        err = lfs_dir_fetch(lfs, &lfs->rcache, &root,
+                (const lfs_block_t[2]){0, 1});
         if (err) {
             goto cleanup;
         }
@@ -3632,6 +5864,7 @@ static int lfs_rawformat(lfs_t *lfs, const struct lfs_config *cfg) {
     }
 
 cleanup:
+    err = lfs_bd_settle(lfs, err);
     lfs_deinit(lfs);
     return err;
 
@@ -3647,6 +5880,7 @@ static int lfs_rawmount(lfs_t *lfs, const struct lfs_config *cfg) {
     // scan directory blocks for superblock and any global updates
     lfs_mdir_t dir = {.tail = {0, 1}};
     lfs_block_t cycle = 0;
+    bool checkpointed = false;
     while (!lfs_pair_isnull(dir.tail)) {
         if (cycle >= lfs->cfg->block_count/2) {
             // loop detected
@@ -3656,12 +5890,12 @@ static int lfs_rawmount(lfs_t *lfs, const struct lfs_config *cfg) {
         cycle += 1;
 
         // fetch next block in tail list
-        lfs_stag_t tag = lfs_dir_fetchmatch(lfs, &dir, dir.tail,
+        lfs_stag_t tag = lfs_dir_fetchmatch(lfs, &lfs->rcache, &dir, dir.tail,
                 LFS_MKTAG(0x7ff, 0x3ff, 0),
                 LFS_MKTAG(LFS_TYPE_SUPERBLOCK, 0, 8),
                 NULL,
                 lfs_dir_find_match, &(struct lfs_dir_find_match){
-                    lfs, "littlefs", 8});
+                    lfs, &lfs->rcache, "littlefs", 8, NULL});
         if (tag < 0) {
             err = tag;
             goto cleanup;
@@ -3675,7 +5909,8 @@ static int lfs_rawmount(lfs_t *lfs, const struct lfs_config *cfg) {
 
             // grab superblock
             lfs_superblock_t superblock;
-            tag = lfs_dir_get(lfs, &dir, LFS_MKTAG(0x7ff, 0x3ff, 0),
+            tag = lfs_dir_get(lfs, &lfs->rcache, &dir,
+                    LFS_MKTAG(0x7ff, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
                     &superblock);
             if (tag < 0) {
@@ -3684,11 +5919,15 @@ static int lfs_rawmount(lfs_t *lfs, const struct lfs_config *cfg) {
             }
             lfs_superblock_fromle32(&superblock);
 
-            // check version
+            // check version, a checkpoint bumps the minor version so drivers
+            // that don't know to drop it won't write
+            bool hascheckpoint = lfs_tag_size(tag) > sizeof(superblock);
             uint16_t major_version = (0xffff & (superblock.version >> 16));
             uint16_t minor_version = (0xffff & (superblock.version >>  0));
             if ((major_version != LFS_DISK_VERSION_MAJOR ||
-                 minor_version > LFS_DISK_VERSION_MINOR)) {
+                 minor_version > (hascheckpoint
+                    ? (0xffff & LFS_DISK_VERSION_CHECKPOINT)
+                    : LFS_DISK_VERSION_MINOR))) {
                 LFS_ERROR("Invalid version v%"PRIu16".%"PRIu16,
                         major_version, minor_version);
                 err = LFS_ERR_INVAL;
@@ -3728,6 +5967,29 @@ static int lfs_rawmount(lfs_t *lfs, const struct lfs_config *cfg) {
 
                 lfs->attr_max = superblock.attr_max;
             }
+
+            // has checkpoint? we need to drop it before writing even if
+            // we don't use it
+            if (hascheckpoint) {
+                lfs->checkpointed = true;
+
+                if (lfs->cfg->checkpoint &&
+                        superblock.version == LFS_DISK_VERSION_CHECKPOINT) {
+                    int res = lfs_fs_loadcheckpoint(lfs, &dir,
+                            lfs_tag_size(tag));
+                    if (res < 0) {
+                        err = res;
+                        goto cleanup;
+                    }
+
+                    if (res) {
+                        // gstate of every metadata pair, including this one,
+                        // is in the checkpoint, no need to scan further
+                        checkpointed = true;
+                        break;
+                    }
+                }
+            }
         }
 
         // has gstate?
@@ -3743,14 +6005,16 @@ static int lfs_rawmount(lfs_t *lfs, const struct lfs_config *cfg) {
         goto cleanup;
     }
 
-    // update littlefs with gstate
+    // update littlefs with gstate, a checkpoint holds it as it was in use
     if (!lfs_gstate_iszero(&lfs->gstate)) {
         LFS_DEBUG("Found pending gstate 0x%08"PRIx32"%08"PRIx32"%08"PRIx32,
                 lfs->gstate.tag,
                 lfs->gstate.pair[0],
                 lfs->gstate.pair[1]);
     }
-    lfs->gstate.tag += !lfs_tag_isvalid(lfs->gstate.tag);
+    if (!checkpointed) {
+        lfs->gstate.tag += !lfs_tag_isvalid(lfs->gstate.tag);
+    }
     lfs->gdisk = lfs->gstate;
 
     // setup free lookahead, to distribute allocations uniformly across
@@ -3758,15 +6022,41 @@ static int lfs_rawmount(lfs_t *lfs, const struct lfs_config *cfg) {
     lfs->free.off = lfs->seed % lfs->cfg->block_count;
     lfs_alloc_drop(lfs);
 
+#ifndef LFS_READONLY
+    if (lfs_alloc_ismap(lfs)) {
+        // lookahead covers the whole device, build it now instead of in
+        // the middle of the first write, if this fails the first write
+        // tries again and reports the error
+        if (lfs_alloc_scan(lfs)) {
+            lfs_alloc_drop(lfs);
+        }
+    }
+#endif
+
     return 0;
 
 cleanup:
-    lfs_rawunmount(lfs);
+    lfs_deinit(lfs);
     return err;
 }
 
 static int lfs_rawunmount(lfs_t *lfs) {
-    return lfs_deinit(lfs);
+    int err = 0;
+#ifndef LFS_READONLY
+    if (lfs->cfg->checkpoint) {
+        // the checkpoint is only an optimization, if the superblock can't
+        // take it the next mount just scans
+        err = lfs_fs_rawcheckpoint(lfs);
+        if (err == LFS_ERR_NOSPC || err == LFS_ERR_NOMEM ||
+                err == LFS_ERR_CORRUPT) {
+            err = 0;
+        }
+    }
+#endif
+
+    err = lfs_bd_settle(lfs, err);
+    int res = lfs_deinit(lfs);
+    return err ? err : res;
 }
 
 
@@ -3806,14 +6096,15 @@ int lfs_fs_rawtraverse(lfs_t *lfs,
         }
 
         // iterate through ids in directory
-        int err = lfs_dir_fetch(lfs, &dir, dir.tail);
+        int err = lfs_dir_fetch(lfs, &lfs->rcache, &dir, dir.tail);
         if (err) {
             return err;
         }
 
         for (uint16_t id = 0; id < dir.count; id++) {
             struct lfs_ctz ctz;
-            lfs_stag_t tag = lfs_dir_get(lfs, &dir, LFS_MKTAG(0x700, 0x3ff, 0),
+            lfs_stag_t tag = lfs_dir_get(lfs, &lfs->rcache, &dir,
+                    LFS_MKTAG(0x700, 0x3ff, 0),
                     LFS_MKTAG(LFS_TYPE_STRUCT, id, sizeof(ctz)), &ctz);
             if (tag < 0) {
                 if (tag == LFS_ERR_NOENT) {
@@ -3864,6 +6155,14 @@ int lfs_fs_rawtraverse(lfs_t *lfs,
             }
         }
     }
+
+    // and any files held by a transaction
+    if (lfs->txn) {
+        int err = lfs_txn_traverse(lfs, lfs->txn, cb, data);
+        if (err) {
+            return err;
+        }
+    }
 #endif
 
     return 0;
@@ -3887,7 +6186,7 @@ static int lfs_fs_pred(lfs_t *lfs,
             return 0;
         }
 
-        int err = lfs_dir_fetch(lfs, pdir, pdir->tail);
+        int err = lfs_dir_fetch(lfs, &lfs->rcache, pdir, pdir->tail);
         if (err) {
             return err;
         }
@@ -3939,7 +6238,8 @@ static lfs_stag_t lfs_fs_parent(lfs_t *lfs, const lfs_block_t pair[2],
         }
         cycle += 1;
 
-        lfs_stag_t tag = lfs_dir_fetchmatch(lfs, parent, parent->tail,
+        lfs_stag_t tag = lfs_dir_fetchmatch(lfs, &lfs->rcache, parent,
+                parent->tail,
                 LFS_MKTAG(0x7ff, 0, 0x3ff),
                 LFS_MKTAG(LFS_TYPE_DIRSTRUCT, 0, 8),
                 NULL,
@@ -4060,41 +6360,467 @@ static void lfs_fs_preporphans(lfs_t *lfs, int8_t orphans) {
 }
 #endif
 
-#ifndef LFS_READONLY
-static void lfs_fs_prepmove(lfs_t *lfs,
-        uint16_t id, const lfs_block_t pair[2]) {
-    lfs->gstate.tag = ((lfs->gstate.tag & ~LFS_MKTAG(0x7ff, 0x3ff, 0)) |
-            ((id != 0x3ff) ? LFS_MKTAG(LFS_TYPE_DELETE, id, 0) : 0));
-    lfs->gstate.pair[0] = (id != 0x3ff) ? pair[0] : 0;
-    lfs->gstate.pair[1] = (id != 0x3ff) ? pair[1] : 0;
+#ifndef LFS_READONLY
+static void lfs_fs_prepmove(lfs_t *lfs,
+        uint16_t id, const lfs_block_t pair[2]) {
+    lfs->gstate.tag = ((lfs->gstate.tag & ~LFS_MKTAG(0x7ff, 0x3ff, 0)) |
+            ((id != 0x3ff) ? LFS_MKTAG(LFS_TYPE_DELETE, id, 0) : 0));
+    lfs->gstate.pair[0] = (id != 0x3ff) ? pair[0] : 0;
+    lfs->gstate.pair[1] = (id != 0x3ff) ? pair[1] : 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_fs_demove(lfs_t *lfs) {
+    if (!lfs_gstate_hasmove(&lfs->gdisk)) {
+        return 0;
+    }
+
+    // Fix bad moves
+    LFS_DEBUG("Fixing move {0x%"PRIx32", 0x%"PRIx32"} 0x%"PRIx16,
+            lfs->gdisk.pair[0],
+            lfs->gdisk.pair[1],
+            lfs_tag_id(lfs->gdisk.tag));
+
+    // fetch and delete the moved entry
+    lfs_mdir_t movedir;
+    int err = lfs_dir_fetch(lfs, &lfs->rcache, &movedir, lfs->gdisk.pair);
+    if (err) {
+        return err;
+    }
+
+    // prep gstate and delete move id
+    uint16_t moveid = lfs_tag_id(lfs->gdisk.tag);
+    lfs_fs_prepmove(lfs, 0x3ff, NULL);
+    err = lfs_dir_commit(lfs, &movedir, LFS_MKATTRS(
+            {LFS_MKTAG(LFS_TYPE_DELETE, moveid, 0), NULL}));
+    if (err) {
+        return err;
+    }
+
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_fs_deorphan(lfs_t *lfs) {
+    if (!lfs_gstate_hasorphans(&lfs->gstate)) {
+        return 0;
+    }
+
+    // Fix any orphans
+    lfs_mdir_t pdir = {.split = true, .tail = {0, 1}};
+    lfs_mdir_t dir;
+
+    // iterate over all directory directory entries
+    while (!lfs_pair_isnull(pdir.tail)) {
+        int err = lfs_dir_fetch(lfs, &lfs->rcache, &dir, pdir.tail);
+        if (err) {
+            return err;
+        }
+
+        // check head blocks for orphans
+        if (!pdir.split) {
+            // check if we have a parent
+            lfs_mdir_t parent;
+            lfs_stag_t tag = lfs_fs_parent(lfs, pdir.tail, &parent);
+            if (tag < 0 && tag != LFS_ERR_NOENT) {
+                return tag;
+            }
+
+            if (tag == LFS_ERR_NOENT) {
+                // we are an orphan
+                LFS_DEBUG("Fixing orphan {0x%"PRIx32", 0x%"PRIx32"}",
+                        pdir.tail[0], pdir.tail[1]);
+
+                err = lfs_dir_drop(lfs, &pdir, &dir);
+                if (err) {
+                    return err;
+                }
+
+                lfs_alloc_release(lfs, dir.pair[0]);
+                lfs_alloc_release(lfs, dir.pair[1]);
+
+                // refetch tail
+                continue;
+            }
+
+            lfs_block_t pair[2];
+            lfs_stag_t res = lfs_dir_get(lfs, &lfs->rcache, &parent,
+                    LFS_MKTAG(0x7ff, 0x3ff, 0), tag, pair);
+            if (res < 0) {
+                return res;
+            }
+            lfs_pair_fromle32(pair);
+
+            if (!lfs_pair_sync(pair, pdir.tail)) {
+                // we have desynced
+                LFS_DEBUG("Fixing half-orphan {0x%"PRIx32", 0x%"PRIx32"} "
+                            "-> {0x%"PRIx32", 0x%"PRIx32"}",
+                        pdir.tail[0], pdir.tail[1], pair[0], pair[1]);
+
+                lfs_pair_tole32(pair);
+                err = lfs_dir_commit(lfs, &pdir, LFS_MKATTRS(
+                        {LFS_MKTAG(LFS_TYPE_SOFTTAIL, 0x3ff, 8), pair}));
+                lfs_pair_fromle32(pair);
+                if (err) {
+                    return err;
+                }
+
+                // refetch tail
+                continue;
+            }
+        }
+
+        pdir = dir;
+    }
+
+    // mark orphans as fixed
+    lfs_fs_preporphans(lfs, -lfs_gstate_getorphans(&lfs->gstate));
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_fs_forceconsistency(lfs_t *lfs) {
+    // drop any checkpoint before callers hold on to copies of metadata
+    // pairs, dropping it in the middle of an operation would leave their
+    // copy of the root stale
+    if (lfs->checkpointed) {
+        int err = lfs_fs_dropcheckpoint(lfs, NULL);
+        if (err) {
+            return err;
+        }
+    }
+
+    int err = lfs_fs_demove(lfs);
+    if (err) {
+        return err;
+    }
+
+    err = lfs_fs_deorphan(lfs);
+    if (err) {
+        return err;
+    }
+
+    return 0;
+}
+#endif
+
+#ifndef LFS_READONLY
+static int lfs_fs_checkpointpair(lfs_t *lfs, const lfs_mdir_t *dir,
+        uint8_t *buffer) {
+    // the other block's revision changes if it is compacted into
+    uint32_t rev;
+    int err = lfs_bd_read(lfs,
+            NULL, &lfs->rcache, sizeof(rev),
+            dir->pair[1], 0, &rev, sizeof(rev));
+    if (err) {
+        return err;
+    }
+
+    lfs_checkpoint_pair_t cpair = {
+        .pair = {dir->pair[0], dir->pair[1]},
+        .rev  = {dir->rev, lfs_fromle32(rev)},
+        .off  = dir->off,
+        .etag = dir->etag,
+    };
+    lfs_checkpoint_pair_tole32(&cpair);
+    memcpy(buffer, &cpair, sizeof(cpair));
+    return 0;
+}
+#endif
+
+static int lfs_fs_checkpointed(lfs_t *lfs, const lfs_mdir_t *root,
+        const lfs_checkpoint_pair_t *cpair, lfs_size_t size) {
+    if (cpair->pair[0] >= lfs->cfg->block_count ||
+            cpair->pair[1] >= lfs->cfg->block_count) {
+        return false;
+    }
+
+    // any compaction changes the revision of one of the blocks
+    for (int i = 0; i < 2; i++) {
+        uint32_t rev;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, sizeof(rev),
+                cpair->pair[i], 0, &rev, sizeof(rev));
+        if (err) {
+            return (err == LFS_ERR_CORRUPT) ? false : err;
+        }
+
+        if (lfs_fromle32(rev) != cpair->rev[i]) {
+            return false;
+        }
+    }
+
+    if (!root) {
+        // any commit programs a valid tag where the pair ended
+        if (cpair->off + sizeof(lfs_tag_t) > lfs->cfg->block_size) {
+            return true;
+        }
+
+        lfs_tag_t tag;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, sizeof(tag),
+                cpair->pair[0], cpair->off, &tag, sizeof(tag));
+        if (err) {
+            return (err == LFS_ERR_CORRUPT) ? false : err;
+        }
+
+        return !lfs_tag_isvalid(lfs_frombe32(tag) ^ cpair->etag);
+    }
+
+    // the root is recorded as it was before the checkpoint was committed,
+    // the checkpoint must be the only thing written since
+    if (lfs_pair_cmp(root->pair, cpair->pair) != 0 ||
+            root->pair[0] != cpair->pair[0]) {
+        return false;
+    }
+
+    lfs_off_t off = cpair->off;
+    lfs_tag_t ptag = cpair->etag;
+    bool crced = false;
+    while (off < root->off) {
+        lfs_tag_t tag;
+        int err = lfs_bd_read(lfs,
+                NULL, &lfs->rcache, sizeof(tag),
+                root->pair[0], off, &tag, sizeof(tag));
+        if (err) {
+            return (err == LFS_ERR_CORRUPT) ? false : err;
+        }
+        tag = lfs_frombe32(tag) ^ ptag;
+
+        // the checkpoint comes first, only its gstate and crcs may follow
+        if (off == cpair->off
+                ? tag != LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, size)
+                : (lfs_tag_type1(tag) != LFS_TYPE_CRC &&
+                    (crced || lfs_tag_type3(tag) != LFS_TYPE_MOVESTATE))) {
+            return false;
+        }
+
+        ptag = tag;
+        if (lfs_tag_type1(tag) == LFS_TYPE_CRC) {
+            ptag ^= (lfs_tag_t)(lfs_tag_chunk(tag) & 1U) << 31;
+            crced = true;
+        }
+        off += lfs_tag_dsize(tag);
+    }
+
+    return off == root->off && off > cpair->off;
+}
+
+static int lfs_fs_loadcheckpoint(lfs_t *lfs,
+        const lfs_mdir_t *root, lfs_size_t size) {
+    // the checkpoint follows the superblock in its inline-struct
+    lfs_checkpoint_t checkpoint;
+    lfs_off_t off = sizeof(lfs_superblock_t);
+    if (size < off + sizeof(checkpoint) + sizeof(uint32_t)) {
+        return false;
+    }
+
+    lfs_stag_t tag = lfs_dir_getslice(lfs, &lfs->rcache, root,
+            LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, size),
+            off, &checkpoint, sizeof(checkpoint));
+    if (tag < 0) {
+        return tag;
+    }
+    off += sizeof(checkpoint);
+
+    uint32_t crc = lfs_crc(0xffffffff, &checkpoint, sizeof(checkpoint));
+    lfs_checkpoint_fromle32(&checkpoint);
+    if (checkpoint.count == 0 || checkpoint.count > 0x3fe ||
+            size != off + checkpoint.count*sizeof(lfs_checkpoint_pair_t)
+                + sizeof(uint32_t)) {
+        return false;
+    }
+
+    // the checkpoint is only current if none of the metadata pairs it
+    // covers have been written since, the root comes first
+    for (lfs_size_t i = 0; i < checkpoint.count; i++) {
+        lfs_checkpoint_pair_t cpair;
+        tag = lfs_dir_getslice(lfs, &lfs->rcache, root,
+                LFS_MKTAG(0x7ff, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, size),
+                off, &cpair, sizeof(cpair));
+        if (tag < 0) {
+            return tag;
+        }
+        off += sizeof(cpair);
+
+        crc = lfs_crc(crc, &cpair, sizeof(cpair));
+        lfs_checkpoint_pair_fromle32(&cpair);
+        int res = lfs_fs_checkpointed(lfs, (i == 0) ? root : NULL,
+                &cpair, size);
+        if (res <= 0) {
+            return res;
+        }
+    }
+
+    uint32_t ccrc;
+    tag = lfs_dir_getslice(lfs, &lfs->rcache, root,
+            LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, size),
+            off, &ccrc, sizeof(ccrc));
+    if (tag < 0) {
+        return tag;
+    }
+
+    if (lfs_fromle32(ccrc) != crc) {
+        return false;
+    }
+
+    lfs->gstate = checkpoint.gstate;
+    lfs->seed ^= checkpoint.seed;
+    return true;
+}
+
+#ifndef LFS_READONLY
+static int lfs_fs_commitcheckpoint(lfs_t *lfs,
+        uint8_t *buffer, lfs_size_t max) {
+    uint8_t *cpairs = &buffer[sizeof(lfs_superblock_t)
+            + sizeof(lfs_checkpoint_t)];
+
+    for (int i = 0; i < 2; i++) {
+        lfs_mdir_t root;
+        int err = lfs_dir_fetch(lfs, &lfs->rcache, &root, lfs->root);
+        if (err) {
+            return err;
+        }
+
+        lfs_superblock_t superblock;
+        lfs_stag_t tag = lfs_dir_get(lfs, &lfs->rcache, &root,
+                LFS_MKTAG(0x7ff, 0x3ff, 0),
+                LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
+                &superblock);
+        if (tag < 0) {
+            return tag;
+        }
+        superblock.version = lfs_tole32(LFS_DISK_VERSION_CHECKPOINT);
+        memcpy(buffer, &superblock, sizeof(superblock));
+
+        // record every metadata pair, the root as it is before the
+        // checkpoint is committed
+        lfs_size_t count = 0;
+        lfs_mdir_t dir = root;
+        while (true) {
+            if (count >= max) {
+                // too many metadata pairs, mount will have to scan
+                return LFS_ERR_NOSPC;
+            }
+
+            err = lfs_fs_checkpointpair(lfs, &dir,
+                    &cpairs[count*sizeof(lfs_checkpoint_pair_t)]);
+            if (err) {
+                return err;
+            }
+            count += 1;
+
+            if (lfs_pair_isnull(dir.tail)) {
+                break;
+            }
+
+            err = lfs_dir_fetch(lfs, &lfs->rcache, &dir, dir.tail);
+            if (err) {
+                return err;
+            }
+        }
+
+        // this commit brings gdisk up to date with gstate, so that's the
+        // gstate to record
+        lfs_checkpoint_t checkpoint = {
+            .gstate = lfs->gstate,
+            .seed   = lfs->seed,
+            .count  = count,
+        };
+        lfs_checkpoint_tole32(&checkpoint);
+        memcpy(&buffer[sizeof(lfs_superblock_t)],
+                &checkpoint, sizeof(checkpoint));
+
+        lfs_size_t size = sizeof(lfs_superblock_t) + sizeof(lfs_checkpoint_t)
+                + count*sizeof(lfs_checkpoint_pair_t) + sizeof(uint32_t);
+        uint32_t crc = lfs_tole32(lfs_crc(0xffffffff,
+                &buffer[sizeof(lfs_superblock_t)],
+                size - sizeof(lfs_superblock_t) - sizeof(crc)));
+        memcpy(&buffer[size - sizeof(crc)], &crc, sizeof(crc));
+
+        lfs_block_t pair = root.pair[0];
+        uint32_t rev = root.rev;
+        lfs->checkpointed = false;
+        err = lfs_dir_commit(lfs, &root, LFS_MKATTRS(
+                {LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, size), buffer}));
+        if (err) {
+            // an earlier attempt is still on disk
+            lfs->checkpointed = (i > 0);
+            return err;
+        }
+        lfs->checkpointed = true;
+
+        // if the commit compacted the root, the checkpoint isn't the only
+        // commit since the root was recorded, mount would ignore it
+        if (root.pair[0] == pair && root.rev == rev) {
+            break;
+        }
+    }
+
+    return 0;
 }
-#endif
 
-#ifndef LFS_READONLY
-static int lfs_fs_demove(lfs_t *lfs) {
-    if (!lfs_gstate_hasmove(&lfs->gdisk)) {
+static int lfs_fs_rawcheckpoint(lfs_t *lfs) {
+    if (lfs->checkpointed) {
+        // nothing written since the last checkpoint
         return 0;
     }
 
-    // Fix bad moves
-    LFS_DEBUG("Fixing move {0x%"PRIx32", 0x%"PRIx32"} 0x%"PRIx16,
-            lfs->gdisk.pair[0],
-            lfs->gdisk.pair[1],
-            lfs_tag_id(lfs->gdisk.tag));
+    // the checkpoint must fit in the superblock's inline-struct and leave
+    // the root room for everything else
+    lfs_size_t limit = lfs_min(0x3fe, lfs->cfg->block_size/4);
+    lfs_size_t header = sizeof(lfs_superblock_t) + sizeof(lfs_checkpoint_t)
+            + sizeof(uint32_t);
+    if (limit < header + sizeof(lfs_checkpoint_pair_t)) {
+        return LFS_ERR_NOSPC;
+    }
 
-    // fetch and delete the moved entry
-    lfs_mdir_t movedir;
-    int err = lfs_dir_fetch(lfs, &movedir, lfs->gdisk.pair);
-    if (err) {
-        return err;
+    uint8_t *buffer = lfs_malloc(limit);
+    if (!buffer) {
+        return LFS_ERR_NOMEM;
     }
 
-    // prep gstate and delete move id
-    uint16_t moveid = lfs_tag_id(lfs->gdisk.tag);
-    lfs_fs_prepmove(lfs, 0x3ff, NULL);
-    err = lfs_dir_commit(lfs, &movedir, LFS_MKATTRS(
-            {LFS_MKTAG(LFS_TYPE_DELETE, moveid, 0), NULL}));
+    int err = lfs_fs_commitcheckpoint(lfs, buffer,
+            (limit - header) / sizeof(lfs_checkpoint_pair_t));
+    lfs_free(buffer);
+    return err;
+}
+
+static int lfs_fs_dropcheckpoint(lfs_t *lfs, lfs_mdir_t *dir) {
+    // commit through the caller's mdir if it's the root so it stays current
+    lfs_mdir_t root;
+    lfs_mdir_t *rdir = dir;
+    if (!dir || lfs_pair_cmp(dir->pair, lfs->root) != 0) {
+        int err = lfs_dir_fetch(lfs, &lfs->rcache, &root, lfs->root);
+        if (err) {
+            return err;
+        }
+        rdir = &root;
+    }
+
+    lfs_superblock_t superblock;
+    lfs_stag_t tag = lfs_dir_get(lfs, &lfs->rcache, rdir,
+            LFS_MKTAG(0x7ff, 0x3ff, 0),
+            LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
+            &superblock);
+    if (tag < 0) {
+        return tag;
+    }
+
+    // rewriting the superblock without the checkpoint drops it
+    superblock.version = lfs_tole32(LFS_DISK_VERSION);
+    lfs->checkpointed = false;
+    int err = lfs_dir_commit(lfs, rdir, LFS_MKATTRS(
+            {LFS_MKTAG(LFS_TYPE_INLINESTRUCT, 0, sizeof(superblock)),
+                &superblock}));
     if (err) {
+        lfs->checkpointed = true;
         return err;
     }
 
@@ -4103,91 +6829,76 @@ static int lfs_fs_demove(lfs_t *lfs) {
 #endif
 
 #ifndef LFS_READONLY
-static int lfs_fs_deorphan(lfs_t *lfs) {
-    if (!lfs_gstate_hasorphans(&lfs->gstate)) {
+static int lfs_fs_rawpreerase(lfs_t *lfs) {
+    if (lfs->pool.size == lfs->pool.count) {
         return 0;
     }
 
-    // Fix any orphans
-    lfs_mdir_t pdir = {.split = true, .tail = {0, 1}};
-    lfs_mdir_t dir;
-
-    // iterate over all directory directory entries
-    while (!lfs_pair_isnull(pdir.tail)) {
-        int err = lfs_dir_fetch(lfs, &dir, pdir.tail);
+    if (lfs->free.i == lfs->free.size && lfs->free.ack > 0 &&
+            lfs->free.size != lfs->cfg->block_count) {
+        // the allocator would have to look for more free blocks on its next
+        // allocation, we may as well do it now
+        int err = lfs_alloc_scan(lfs);
         if (err) {
             return err;
         }
+    }
 
-        // check head blocks for orphans
-        if (!pdir.split) {
-            // check if we have a parent
-            lfs_mdir_t parent;
-            lfs_stag_t tag = lfs_fs_parent(lfs, pdir.tail, &parent);
-            if (tag < 0 && tag != LFS_ERR_NOENT) {
-                return tag;
-            }
-
-            if (tag == LFS_ERR_NOENT) {
-                // we are an orphan
-                LFS_DEBUG("Fixing orphan {0x%"PRIx32", 0x%"PRIx32"}",
-                        pdir.tail[0], pdir.tail[1]);
-
-                err = lfs_dir_drop(lfs, &pdir, &dir);
-                if (err) {
-                    return err;
-                }
-
-                // refetch tail
-                continue;
-            }
+    // the allocator hands out free blocks in the lookahead window in order,
+    // erase the next one we haven't already
+    for (lfs_block_t off = lfs->free.i; off < lfs->free.size; off++) {
+        if (lfs->free.buffer[off / 32] & (1U << (off % 32))) {
+            continue;
+        }
 
-            lfs_block_t pair[2];
-            lfs_stag_t res = lfs_dir_get(lfs, &parent,
-                    LFS_MKTAG(0x7ff, 0x3ff, 0), tag, pair);
-            if (res < 0) {
-                return res;
-            }
-            lfs_pair_fromle32(pair);
+        lfs_block_t block = (lfs->free.off + off) % lfs->cfg->block_count;
+        if (lfs_pool_find(lfs, block) != lfs->pool.size) {
+            continue;
+        }
 
-            if (!lfs_pair_sync(pair, pdir.tail)) {
-                // we have desynced
-                LFS_DEBUG("Fixing half-orphan {0x%"PRIx32", 0x%"PRIx32"} "
-                            "-> {0x%"PRIx32", 0x%"PRIx32"}",
-                        pdir.tail[0], pdir.tail[1], pair[0], pair[1]);
+        // wait for the erase, the block is only any good to us if it
+        // actually erased
+        int err = lfs_bd_erase(lfs, block);
+        if (!err) {
+            err = lfs_bd_wait(lfs);
+        }
 
-                lfs_pair_tole32(pair);
-                err = lfs_dir_commit(lfs, &pdir, LFS_MKATTRS(
-                        {LFS_MKTAG(LFS_TYPE_SOFTTAIL, 0x3ff, 8), pair}));
-                lfs_pair_fromle32(pair);
-                if (err) {
-                    return err;
-                }
+        if (!err && lfs->erasing.bad == block) {
+            lfs->erasing.bad = LFS_BLOCK_NULL;
+            err = LFS_ERR_CORRUPT;
+        }
 
-                // refetch tail
-                continue;
-            }
+        if (err == LFS_ERR_CORRUPT) {
+            // bad block, keep the allocator away from it until the next
+            // scan, it will find out for itself then
+            lfs->free.buffer[off / 32] |= 1U << (off % 32);
+            lfs->free.used += 1;
+            continue;
+        } else if (err) {
+            return err;
         }
 
-        pdir = dir;
+        lfs->pool.blocks[lfs->pool.size] = block;
+        lfs->pool.size += 1;
+        return 1;
     }
 
-    // mark orphans as fixed
-    lfs_fs_preporphans(lfs, -lfs_gstate_getorphans(&lfs->gstate));
     return 0;
 }
 #endif
 
 #ifndef LFS_READONLY
-static int lfs_fs_forceconsistency(lfs_t *lfs) {
-    int err = lfs_fs_demove(lfs);
-    if (err) {
-        return err;
-    }
+static int lfs_fs_rawsync(lfs_t *lfs, uint32_t flags) {
+    for (struct lfs_mlist *p = lfs->mlist; p; p = p->next) {
+        lfs_file_t *file = (lfs_file_t*)p;
+        if (p->type != LFS_TYPE_REG || !(file->flags & flags)) {
+            continue;
+        }
 
-    err = lfs_fs_deorphan(lfs);
-    if (err) {
-        return err;
+        int err = lfs_file_rawsync(lfs, file);
+        if (err) {
+            return err;
+        }
     }
 
     return 0;
@@ -4211,6 +6922,15 @@ static lfs_ssize_t lfs_fs_rawsize(lfs_t *lfs) {
     return size;
 }
 
+static lfs_ssize_t lfs_fs_rawusage(lfs_t *lfs) {
+    if (lfs->usage >= 0) {
+        // counted as blocks are allocated and released
+        return lfs->usage;
+    }
+
+    return lfs_fs_rawsize(lfs);
+}
+
 #ifdef LFS_MIGRATE
 ////// Migration from littelfs v1 below this //////
 
@@ -4499,7 +7219,7 @@ int lfs1_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data) {
         // we also need to check if we contain a threaded v2 directory
         lfs_mdir_t dir2 = {.split=true, .tail={cwd[0], cwd[1]}};
         while (dir2.split) {
-            err = lfs_dir_fetch(lfs, &dir2, dir2.tail);
+            err = lfs_dir_fetch(lfs, &lfs->rcache, &dir2, dir2.tail);
             if (err) {
                 break;
             }
@@ -4709,13 +7429,14 @@ static int lfs_rawmigrate(lfs_t *lfs, const struct lfs_config *cfg) {
                 bool isdir = (entry1.d.type == LFS1_TYPE_DIR);
 
                 // create entry in new dir
-                err = lfs_dir_fetch(lfs, &dir2, lfs->root);
+                err = lfs_dir_fetch(lfs, &lfs->rcache, &dir2, lfs->root);
                 if (err) {
                     goto cleanup;
                 }
 
                 uint16_t id;
-                err = lfs_dir_find(lfs, &dir2, &(const char*){name}, &id);
+                err = lfs_dir_find(lfs, &lfs->rcache, &dir2,
+                        &(const char*){name}, &id);
                 if (!(err == LFS_ERR_NOENT && id != 0x3ff)) {
                     err = (err < 0) ? err : LFS_ERR_EXIST;
                     goto cleanup;
@@ -4740,13 +7461,13 @@ static int lfs_rawmigrate(lfs_t *lfs, const struct lfs_config *cfg) {
 
             if (!lfs_pair_isnull(dir1.d.tail)) {
                 // find last block and update tail to thread into fs
-                err = lfs_dir_fetch(lfs, &dir2, lfs->root);
+                err = lfs_dir_fetch(lfs, &lfs->rcache, &dir2, lfs->root);
                 if (err) {
                     goto cleanup;
                 }
 
                 while (dir2.split) {
-                    err = lfs_dir_fetch(lfs, &dir2, dir2.tail);
+                    err = lfs_dir_fetch(lfs, &lfs->rcache, &dir2, dir2.tail);
                     if (err) {
                         goto cleanup;
                     }
@@ -4772,7 +7493,7 @@ static int lfs_rawmigrate(lfs_t *lfs, const struct lfs_config *cfg) {
                 goto cleanup;
             }
 
-            err = lfs_dir_fetch(lfs, &dir2, lfs->root);
+            err = lfs_dir_fetch(lfs, &lfs->rcache, &dir2, lfs->root);
             if (err) {
                 goto cleanup;
             }
@@ -4837,7 +7558,8 @@ static int lfs_rawmigrate(lfs_t *lfs, const struct lfs_config *cfg) {
         }
 
         // sanity check that fetch works
-        err = lfs_dir_fetch(lfs, &dir2, (const lfs_block_t[2]){0, 1});
+        err = lfs_dir_fetch(lfs, &lfs->rcache, &dir2,
+                (const lfs_block_t[2]){0, 1});
         if (err) {
             goto cleanup;
         }
@@ -4955,6 +7677,7 @@ int lfs_remove(lfs_t *lfs, const char *path) {
     LFS_TRACE("lfs_remove(%p, \"%s\")", (void*)lfs, path);
 
     err = lfs_rawremove(lfs, path);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_remove -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -4971,6 +7694,7 @@ int lfs_rename(lfs_t *lfs, const char *oldpath, const char *newpath) {
     LFS_TRACE("lfs_rename(%p, \"%s\", \"%s\")", (void*)lfs, oldpath, newpath);
 
     err = lfs_rawrename(lfs, oldpath, newpath);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_rename -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5019,6 +7743,7 @@ int lfs_setattr(lfs_t *lfs, const char *path,
             (void*)lfs, path, type, buffer, size);
 
     err = lfs_rawsetattr(lfs, path, type, buffer, size);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_setattr -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5035,6 +7760,7 @@ int lfs_removeattr(lfs_t *lfs, const char *path, uint8_t type) {
     LFS_TRACE("lfs_removeattr(%p, \"%s\", %"PRIu8")", (void*)lfs, path, type);
 
     err = lfs_rawremoveattr(lfs, path, type);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_removeattr -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5052,6 +7778,7 @@ int lfs_file_open(lfs_t *lfs, lfs_file_t *file, const char *path, int flags) {
     LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     err = lfs_file_rawopen(lfs, file, path, flags);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_file_open -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5072,6 +7799,7 @@ int lfs_file_opencfg(lfs_t *lfs, lfs_file_t *file,
     LFS_ASSERT(!lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     err = lfs_file_rawopencfg(lfs, file, path, flags, cfg);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_file_opencfg -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5087,6 +7815,7 @@ int lfs_file_close(lfs_t *lfs, lfs_file_t *file) {
     LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     err = lfs_file_rawclose(lfs, file);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_file_close -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5103,6 +7832,7 @@ int lfs_file_sync(lfs_t *lfs, lfs_file_t *file) {
     LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     err = lfs_file_rawsync(lfs, file);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_file_sync -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5110,6 +7840,24 @@ int lfs_file_sync(lfs_t *lfs, lfs_file_t *file) {
 }
 #endif
 
+#ifndef LFS_READONLY
+int lfs_file_lazysync(lfs_t *lfs, lfs_file_t *file) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_lazysync(%p, %p)", (void*)lfs, (void*)file);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    err = lfs_file_rawlazysync(lfs, file);
+    err = lfs_bd_settle(lfs, err);
+
+    LFS_TRACE("lfs_file_lazysync -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
 lfs_ssize_t lfs_file_read(lfs_t *lfs, lfs_file_t *file,
         void *buffer, lfs_size_t size) {
     int err = LFS_LOCK(lfs->cfg);
@@ -5121,6 +7869,7 @@ lfs_ssize_t lfs_file_read(lfs_t *lfs, lfs_file_t *file,
     LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     lfs_ssize_t res = lfs_file_rawread(lfs, file, buffer, size);
+    res = lfs_bd_settle(lfs, res);
 
     LFS_TRACE("lfs_file_read -> %"PRId32, res);
     LFS_UNLOCK(lfs->cfg);
@@ -5139,6 +7888,7 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
     LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     lfs_ssize_t res = lfs_file_rawwrite(lfs, file, buffer, size);
+    res = lfs_bd_settle(lfs, res);
 
     LFS_TRACE("lfs_file_write -> %"PRId32, res);
     LFS_UNLOCK(lfs->cfg);
@@ -5146,6 +7896,44 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
 }
 #endif
 
+lfs_ssize_t lfs_file_pread(lfs_t *lfs, lfs_file_t *file,
+        void *buffer, lfs_size_t size, lfs_off_t off) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_pread(%p, %p, %p, %"PRIu32", %"PRIu32")",
+            (void*)lfs, (void*)file, buffer, size, off);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_rawpread(lfs, file, buffer, size, off);
+    res = lfs_bd_settle(lfs, res);
+
+    LFS_TRACE("lfs_file_pread -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
+#ifndef LFS_READONLY
+lfs_ssize_t lfs_file_pwrite(lfs_t *lfs, lfs_file_t *file,
+        const void *buffer, lfs_size_t size, lfs_off_t off) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_file_pwrite(%p, %p, %p, %"PRIu32", %"PRIu32")",
+            (void*)lfs, (void*)file, buffer, size, off);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    lfs_ssize_t res = lfs_file_rawpwrite(lfs, file, buffer, size, off);
+    res = lfs_bd_settle(lfs, res);
+
+    LFS_TRACE("lfs_file_pwrite -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+#endif
+
 lfs_soff_t lfs_file_seek(lfs_t *lfs, lfs_file_t *file,
         lfs_soff_t off, int whence) {
     int err = LFS_LOCK(lfs->cfg);
@@ -5157,6 +7945,7 @@ lfs_soff_t lfs_file_seek(lfs_t *lfs, lfs_file_t *file,
     LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     lfs_soff_t res = lfs_file_rawseek(lfs, file, off, whence);
+    res = lfs_bd_settle(lfs, res);
 
     LFS_TRACE("lfs_file_seek -> %"PRId32, res);
     LFS_UNLOCK(lfs->cfg);
@@ -5174,6 +7963,7 @@ int lfs_file_truncate(lfs_t *lfs, lfs_file_t *file, lfs_off_t size) {
     LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
 
     err = lfs_file_rawtruncate(lfs, file, size);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_file_truncate -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5204,6 +7994,7 @@ int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file) {
     LFS_TRACE("lfs_file_rewind(%p, %p)", (void*)lfs, (void*)file);
 
     err = lfs_file_rawrewind(lfs, file);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_file_rewind -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5225,6 +8016,21 @@ lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file) {
     return res;
 }
 
+bool lfs_file_isshared(lfs_t *lfs, lfs_file_t *file) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return false;
+    }
+    LFS_TRACE("lfs_file_isshared(%p, %p)", (void*)lfs, (void*)file);
+    LFS_ASSERT(lfs_mlist_isopen(lfs->mlist, (struct lfs_mlist*)file));
+
+    bool res = lfs_file_rawisshared(lfs, file);
+
+    LFS_TRACE("lfs_file_isshared -> %d", res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
 #ifndef LFS_READONLY
 int lfs_mkdir(lfs_t *lfs, const char *path) {
     int err = LFS_LOCK(lfs->cfg);
@@ -5234,6 +8040,7 @@ int lfs_mkdir(lfs_t *lfs, const char *path) {
     LFS_TRACE("lfs_mkdir(%p, \"%s\")", (void*)lfs, path);
 
     err = lfs_rawmkdir(lfs, path);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_mkdir -> %d", err);
     LFS_UNLOCK(lfs->cfg);
@@ -5328,6 +8135,43 @@ int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir) {
     return err;
 }
 
+#ifndef LFS_READONLY
+int lfs_txn_begin(lfs_t *lfs, lfs_txn_t *txn,
+        const struct lfs_txn_config *cfg) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_begin(%p, %p, %p {"
+                ".buffer=%p, .buffer_size=%"PRIu32"})",
+            (void*)lfs, (void*)txn, (void*)cfg,
+            cfg->buffer, cfg->buffer_size);
+
+    err = lfs_txn_rawbegin(lfs, txn, cfg);
+
+    LFS_TRACE("lfs_txn_begin -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_txn_commit(lfs_t *lfs, lfs_txn_t *txn) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_txn_commit(%p, %p)", (void*)lfs, (void*)txn);
+
+    err = lfs_txn_rawcommit(lfs, txn);
+    err = lfs_bd_settle(lfs, err);
+
+    LFS_TRACE("lfs_txn_commit -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
 lfs_ssize_t lfs_fs_size(lfs_t *lfs) {
     int err = LFS_LOCK(lfs->cfg);
     if (err) {
@@ -5342,6 +8186,20 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs) {
     return res;
 }
 
+lfs_ssize_t lfs_fs_usage(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_usage(%p)", (void*)lfs);
+
+    lfs_ssize_t res = lfs_fs_rawusage(lfs);
+
+    LFS_TRACE("lfs_fs_usage -> %"PRId32, res);
+    LFS_UNLOCK(lfs->cfg);
+    return res;
+}
+
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data) {
     int err = LFS_LOCK(lfs->cfg);
     if (err) {
@@ -5357,6 +8215,73 @@ int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void *, lfs_block_t), void *data) {
     return err;
 }
 
+#ifndef LFS_READONLY
+int lfs_fs_checkpoint(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_checkpoint(%p)", (void*)lfs);
+
+    err = lfs_fs_rawcheckpoint(lfs);
+    err = lfs_bd_settle(lfs, err);
+
+    LFS_TRACE("lfs_fs_checkpoint -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_fs_preerase(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_preerase(%p)", (void*)lfs);
+
+    err = lfs_fs_rawpreerase(lfs);
+
+    LFS_TRACE("lfs_fs_preerase -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_fs_sync(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_sync(%p)", (void*)lfs);
+
+    err = lfs_fs_rawsync(lfs, LFS_F_DIRTY | LFS_F_WRITING);
+    err = lfs_bd_settle(lfs, err);
+
+    LFS_TRACE("lfs_fs_sync -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
+#ifndef LFS_READONLY
+int lfs_fs_syncheld(lfs_t *lfs) {
+    int err = LFS_LOCK(lfs->cfg);
+    if (err) {
+        return err;
+    }
+    LFS_TRACE("lfs_fs_syncheld(%p)", (void*)lfs);
+
+    err = lfs_fs_rawsync(lfs, LFS_F_HELD);
+    err = lfs_bd_settle(lfs, err);
+
+    LFS_TRACE("lfs_fs_syncheld -> %d", err);
+    LFS_UNLOCK(lfs->cfg);
+    return err;
+}
+#endif
+
 #ifdef LFS_MIGRATE
 int lfs_migrate(lfs_t *lfs, const struct lfs_config *cfg) {
     int err = LFS_LOCK(cfg);
@@ -5381,6 +8306,7 @@ int lfs_migrate(lfs_t *lfs, const struct lfs_config *cfg) {
             cfg->name_max, cfg->file_max, cfg->attr_max);
 
     err = lfs_rawmigrate(lfs, cfg);
+    err = lfs_bd_settle(lfs, err);
 
     LFS_TRACE("lfs_migrate -> %d", err);
     LFS_UNLOCK(cfg);
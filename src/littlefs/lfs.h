@@ -34,6 +34,10 @@ extern "C"
 #define LFS_DISK_VERSION_MAJOR (0xffff & (LFS_DISK_VERSION >> 16))
 #define LFS_DISK_VERSION_MINOR (0xffff & (LFS_DISK_VERSION >>  0))
 
+// Version of On-disk data structures while the superblock holds a checkpoint,
+// so drivers that don't know to drop the checkpoint refuse to write
+#define LFS_DISK_VERSION_CHECKPOINT 0x00020001
+
 
 /// Definitions ///
 
@@ -68,6 +72,19 @@ typedef uint32_t lfs_block_t;
 #define LFS_ATTR_MAX 1022
 #endif
 
+// Maximum length of a name held in the path lookup cache, longer names are
+// always looked up on disk. Limited to <= 255.
+#ifndef LFS_DCACHE_NAME_MAX
+#define LFS_DCACHE_NAME_MAX 32
+#endif
+
+// Maximum length of the largest name remembered for each metadata pair in
+// the directory index, pairs holding longer names are always fetched.
+// Limited to <= 255.
+#ifndef LFS_DINDEX_NAME_MAX
+#define LFS_DINDEX_NAME_MAX 32
+#endif
+
 // Possible error codes, these are negative to allow
 // valid positive return values
 enum lfs_error {
@@ -144,6 +161,9 @@ enum lfs_open_flags {
     LFS_F_ERRED   = 0x080000, // An error occurred during write
 #endif
     LFS_F_INLINE  = 0x100000, // Currently inlined in directory entry
+#ifndef LFS_READONLY
+    LFS_F_HELD    = 0x200000, // A sync has been held back
+#endif
 };
 
 // File seek flags
@@ -153,6 +173,14 @@ enum lfs_whence_flags {
     LFS_SEEK_END = 2,   // Seek relative to the end of the file
 };
 
+// Region of a block, used by the vectored block device operations
+struct lfs_iovec {
+    lfs_block_t block;
+    lfs_off_t off;
+    void *buffer;
+    lfs_size_t size;
+};
+
 
 // Configuration provided during initialization of the littlefs
 struct lfs_config {
@@ -181,6 +209,36 @@ struct lfs_config {
     // are propogated to the user.
     int (*sync)(const struct lfs_config *c);
 
+    // Optional asynchronous erase. Starts erasing a block and returns
+    // without waiting for the erase to finish. littlefs calls wait before
+    // the next prog, erase or sync, and before the next read unless
+    // erase_reads is set, so only the work up to then overlaps with the
+    // erase, such as filling the prog cache and calculating checksums. The
+    // erase is always waited on before the call that started it returns.
+    // Negative error codes are propogated to the user. May return
+    // LFS_ERR_CORRUPT, here or from wait, if the block should be considered
+    // bad. Disabled when NULL, erase is used instead.
+    int (*erase_async)(const struct lfs_config *c, lfs_block_t block);
+
+    // Wait for an erase started by erase_async to finish. Returns the
+    // result of the erase. Required if erase_async is provided.
+    int (*wait)(const struct lfs_config *c);
+
+    // Set if the block device can read other blocks while an erase started
+    // by erase_async is running, for example a flash part with several
+    // banks. Lets the reads that copy data into a newly erased block, when
+    // compacting a metadata pair or extending a file, overlap with the
+    // erase. Reads of the block being erased still wait.
+    bool erase_reads;
+
+    // Optional vectored read. Reads several regions, possibly in different
+    // blocks, in one call, each region follows the same rules as read.
+    // Lets block devices with a high per-command overhead coalesce reads.
+    // Negative error codes are propogated to the user. Disabled when NULL,
+    // read is used instead.
+    int (*readv)(const struct lfs_config *c,
+            const struct lfs_iovec *iov, int count);
+
 #ifdef LFS_THREADSAFE
     // Lock the underlying block device. Negative error codes
     // are propogated to the user.
@@ -226,7 +284,10 @@ struct lfs_config {
     // Size of the lookahead buffer in bytes. A larger lookahead buffer
     // increases the number of blocks found during an allocation pass. The
     // lookahead buffer is stored as a compact bitmap, so each byte of RAM
-    // can track 8 blocks. Must be a multiple of 8.
+    // can track 8 blocks. Must be a multiple of 8. If the lookahead buffer
+    // covers every block on the device it is built once at mount and then
+    // updated as blocks are allocated and freed, so allocations no longer
+    // need to traverse the filesystem.
     lfs_size_t lookahead_size;
 
     // Optional statically allocated read buffer. Must be cache_size.
@@ -257,6 +318,93 @@ struct lfs_config {
     // larger attributes size but must be <= LFS_ATTR_MAX. Defaults to
     // LFS_ATTR_MAX when zero.
     lfs_size_t attr_max;
+
+    // Optional number of additional read caches. When the read cache is
+    // reloaded its previous contents are kept in one of these, so lookups
+    // that bounce between a few metadata pairs and skip-list blocks don't
+    // evict themselves. Each one costs cache_size bytes of RAM. Disabled
+    // when zero.
+    lfs_size_t rcache_count;
+
+    // Optional associativity of the additional read caches. The caches are
+    // grouped into sets of rcache_ways entries selected by block address and
+    // replaced in least-recently-used order. Must be a factor of
+    // rcache_count. Defaults to rcache_count, fully associative, when zero.
+    lfs_size_t rcache_ways;
+
+    // Optional number of entries in the path lookup cache. Each entry maps a
+    // name in a directory to the metadata pair holding it, or records that
+    // the name does not exist, so repeated lookups of the same paths skip
+    // fetching every directory along the way. Disabled when zero.
+    lfs_size_t dcache_count;
+
+    // Optional number of skip-list checkpoints kept by each open file. Block
+    // addresses found while seeking in a file are remembered, so later seeks
+    // can start from a nearby block instead of from the end of the file.
+    // Speeds up random reads in large files. Disabled when zero.
+    lfs_size_t ctz_cache_count;
+
+    // Optional number of blocks a sequential reader resolves ahead of
+    // itself. Blocks in a file only point backwards, so instead of searching
+    // for every new block from the end of the file, the next few are found
+    // in one pass. Disabled when zero.
+    lfs_size_t readahead_count;
+
+    // Optional size in bytes of a buffer used when compacting metadata pairs.
+    // Finding which tags in a metadata pair have been superseded takes a
+    // rescan of the pair for every tag. With this buffer it takes a single
+    // pass, about 12 bytes per tag. Falls back to rescanning if the pair
+    // doesn't fit. Disabled when zero.
+    lfs_size_t filter_size;
+
+    // Optional number of entries in the directory index. Each entry
+    // remembers the largest name in a metadata pair and where the directory
+    // continues, so lookups in directories split over many metadata pairs
+    // skip fetching the pairs that can't hold the name. Disabled when zero.
+    lfs_size_t dindex_count;
+
+    // Optional flag to write a checkpoint of the mount state to the
+    // superblock on unmount, and to use it on mount. A mount from an intact
+    // checkpoint skips scanning every metadata pair. The checkpoint is dropped
+    // by the first write after mount, so after an unclean shutdown the mount
+    // falls back to the scan, as it does if any metadata pair was written
+    // since. Only filesystems with few enough metadata pairs to list in the
+    // superblock get a checkpoint. Disabled when false.
+    bool checkpoint;
+
+    // Optional number of metadata pairs to keep a summary of. The state of
+    // each metadata pair found by scanning it, including by the mount, is
+    // remembered until the pair is written to, so fetching it again doesn't
+    // need to read or check the pair. Disabled when zero.
+    lfs_size_t mcache_count;
+
+    // Optional number of metadata blocks to remember the checked commits of.
+    // Commits whose checksum has already been verified during this mount are
+    // not read and checked again when the block is fetched, only their tags
+    // are scanned. Disabled when zero.
+    lfs_size_t vcache_count;
+
+    // Optional flag to give each open directory its own read cache of
+    // cache_size bytes. Reading a directory then doesn't evict, or get
+    // evicted by, other reads, and lookups made when opening files and
+    // directories use the handle's buffer. Disabled when false.
+    bool dir_caches;
+
+    // Optional number of free blocks to keep erased ahead of the allocator.
+    // lfs_fs_preerase erases the blocks the allocator will hand out next,
+    // so when it runs during idle time, writes that need a new block don't
+    // have to wait for an erase. The pool only lives in RAM, losing power
+    // just loses some erases. Disabled when zero.
+    lfs_size_t erase_pool_count;
+
+    // Optional number of bytes written to a file before lfs_file_lazysync
+    // commits them. Smaller syncs are held back, leaving the data in the
+    // file's cache for the next writes to fill, and saving a metadata commit
+    // and a copy of the partially written block per sync. lfs_file_sync,
+    // lfs_fs_syncheld, lfs_fs_sync and closing the file commit held syncs.
+    // Losing power loses held syncs, but the file is left as it was at its
+    // last commit. Disabled when zero.
+    lfs_size_t sync_size;
 };
 
 // File info structure
@@ -312,6 +460,20 @@ struct lfs_file_config {
 };
 
 
+// Configuration provided during lfs_txn_begin
+struct lfs_txn_config {
+    // Optional statically allocated transaction buffer. Must be buffer_size
+    // and aligned to hold pointers. By default lfs_malloc is used to
+    // allocate this buffer.
+    void *buffer;
+
+    // Size of the transaction buffer in bytes. Every batched file sync takes
+    // a few words for its metadata, plus the file's contents if it is
+    // inlined, plus its custom attributes.
+    lfs_size_t buffer_size;
+};
+
+
 /// internal littlefs data structures ///
 typedef struct lfs_cache {
     lfs_block_t block;
@@ -340,6 +502,7 @@ typedef struct lfs_dir {
 
     lfs_off_t pos;
     lfs_block_t head[2];
+    lfs_cache_t cache;
 } lfs_dir_t;
 
 // littlefs file type
@@ -359,10 +522,39 @@ typedef struct lfs_file {
     lfs_block_t block;
     lfs_off_t off;
     lfs_cache_t cache;
+    lfs_size_t unsynced;
+
+    struct lfs_ctzcache {
+        lfs_block_t head;
+        lfs_off_t width;
+        lfs_size_t count;
+        struct lfs_ctzpoint {
+            lfs_off_t index;
+            lfs_block_t block;
+        } *points;
+    } ccache;
+
+    struct lfs_ctzahead {
+        lfs_block_t head;
+        lfs_off_t index;
+        lfs_size_t size;
+        lfs_size_t count;
+        lfs_block_t *blocks;
+    } ahead;
 
     const struct lfs_file_config *cfg;
 } lfs_file_t;
 
+// littlefs transaction type
+typedef struct lfs_txn {
+    lfs_block_t pair[2];
+    lfs_size_t count;
+    lfs_size_t off;
+    void *buffer;
+
+    const struct lfs_txn_config *cfg;
+} lfs_txn_t;
+
 typedef struct lfs_superblock {
     uint32_t version;
     lfs_size_t block_size;
@@ -377,11 +569,95 @@ typedef struct lfs_gstate {
     lfs_block_t pair[2];
 } lfs_gstate_t;
 
+typedef struct lfs_checkpoint {
+    lfs_gstate_t gstate;
+    uint32_t seed;
+    uint32_t count;
+} lfs_checkpoint_t;
+
+typedef struct lfs_checkpoint_pair {
+    lfs_block_t pair[2];
+    uint32_t rev[2];
+    lfs_off_t off;
+    uint32_t etag;
+} lfs_checkpoint_pair_t;
+
 // The littlefs filesystem type
 typedef struct lfs {
     lfs_cache_t rcache;
     lfs_cache_t pcache;
 
+    struct lfs_rset {
+        struct lfs_rway {
+            lfs_cache_t cache;
+            uint32_t age;
+        } *ways;
+        lfs_size_t count;
+        lfs_size_t sets;
+        uint32_t age;
+        uint8_t *buffer;
+    } rset;
+
+    struct lfs_dcache {
+        struct lfs_dentry {
+            lfs_block_t parent[2];
+            lfs_mdir_t m;
+            uint32_t tag;
+            uint16_t id;
+            uint8_t size;
+            char name[LFS_DCACHE_NAME_MAX];
+        } *entries;
+        lfs_size_t count;
+    } dcache;
+
+    struct lfs_dindex {
+        struct lfs_dpair {
+            lfs_block_t pair[2];
+            lfs_block_t tail[2];
+            bool split;
+            uint16_t size;
+            char name[LFS_DINDEX_NAME_MAX];
+        } *entries;
+        lfs_size_t count;
+    } dindex;
+
+    struct lfs_mcache {
+        lfs_mdir_t *entries;
+        lfs_size_t count;
+    } mcache;
+
+    struct lfs_vcache {
+        struct lfs_vblock {
+            lfs_block_t block;
+            uint32_t rev;
+            lfs_off_t off;
+        } *entries;
+        lfs_size_t count;
+    } vcache;
+
+    struct lfs_pool {
+        lfs_block_t *blocks;
+        lfs_size_t count;
+        lfs_size_t size;
+    } pool;
+
+    struct lfs_split {
+        uint16_t *sizes;
+        lfs_size_t count;
+    } split;
+
+    struct lfs_erasing {
+        lfs_block_t block;
+        lfs_block_t bad;
+        bool busy;
+    } erasing;
+
+    struct lfs_filter {
+        uint32_t *buffer;
+        lfs_size_t size;
+        lfs_size_t off;
+    } filter;
+
     lfs_block_t root[2];
     struct lfs_mlist {
         struct lfs_mlist *next;
@@ -390,16 +666,21 @@ typedef struct lfs {
         lfs_mdir_t m;
     } *mlist;
     uint32_t seed;
+    lfs_txn_t *txn;
 
     lfs_gstate_t gstate;
     lfs_gstate_t gdisk;
     lfs_gstate_t gdelta;
+    bool checkpointed;
+
+    lfs_ssize_t usage;
 
     struct lfs_free {
         lfs_block_t off;
         lfs_block_t size;
         lfs_block_t i;
         lfs_block_t ack;
+        lfs_block_t used;
         uint32_t *buffer;
     } free;
 
@@ -439,7 +720,8 @@ int lfs_mount(lfs_t *lfs, const struct lfs_config *config);
 
 // Unmounts a littlefs
 //
-// Does nothing besides releasing any allocated resources.
+// Does nothing besides releasing any allocated resources, and writing a
+// checkpoint if the checkpoint option is enabled.
 // Returns a negative error code on failure.
 int lfs_unmount(lfs_t *lfs);
 
@@ -545,6 +827,18 @@ int lfs_file_close(lfs_t *lfs, lfs_file_t *file);
 // Returns a negative error code on failure.
 int lfs_file_sync(lfs_t *lfs, lfs_file_t *file);
 
+#ifndef LFS_READONLY
+// Synchronize a file on storage once enough has been written
+//
+// Like lfs_file_sync, but with the sync_size option the sync is held back
+// until sync_size bytes have been written since the last commit. Held syncs
+// are committed by lfs_fs_syncheld, lfs_fs_sync, lfs_file_sync and closing
+// the file, a held sync is not on storage when this returns.
+//
+// Returns a negative error code on failure.
+int lfs_file_lazysync(lfs_t *lfs, lfs_file_t *file);
+#endif
+
 // Read data from file
 //
 // Takes a buffer and size indicating where to store the read data.
@@ -563,6 +857,28 @@ lfs_ssize_t lfs_file_write(lfs_t *lfs, lfs_file_t *file,
         const void *buffer, lfs_size_t size);
 #endif
 
+// Read data from file at an offset
+//
+// Like lfs_file_read, but reads at the given offset and leaves the position
+// of the file unchanged. Data already in the file's cache is reused.
+// Returns the number of bytes read, or a negative error code on failure.
+lfs_ssize_t lfs_file_pread(lfs_t *lfs, lfs_file_t *file,
+        void *buffer, lfs_size_t size, lfs_off_t off);
+
+#ifndef LFS_READONLY
+// Write data to file at an offset
+//
+// Like lfs_file_write, but writes at the given offset and leaves the
+// position of the file unchanged. Since writes are tied to the position
+// they are made at, the written data is flushed to the file's blocks, but
+// as with lfs_file_write the file is only updated on the storage by sync or
+// close.
+//
+// Returns the number of bytes written, or a negative error code on failure.
+lfs_ssize_t lfs_file_pwrite(lfs_t *lfs, lfs_file_t *file,
+        const void *buffer, lfs_size_t size, lfs_off_t off);
+#endif
+
 // Change the position of the file
 //
 // The change in position is determined by the offset and whence flag.
@@ -595,6 +911,22 @@ int lfs_file_rewind(lfs_t *lfs, lfs_file_t *file);
 // Returns the size of the file, or a negative error code on failure.
 lfs_soff_t lfs_file_size(lfs_t *lfs, lfs_file_t *file);
 
+// Check if reads from the file can run alongside other operations
+//
+// Reading a file that is only open for reading, and whose data isn't inlined
+// in its directory entry, only uses the file's own state and the block
+// device's read. While nothing modifies the filesystem, lfs_file_read,
+// lfs_file_seek, lfs_file_tell and lfs_file_size on such a file can run
+// concurrently with each other on different files, and with at most one
+// other operation that doesn't modify the filesystem. This needs a read
+// callback that can be called concurrently, and calls on the same file
+// still need to be serialized. Asynchronous erases finish before the call
+// that started them returns, so these reads never find one pending and
+// never call wait.
+//
+// Returns true if so, false if reads need the filesystem to themselves.
+bool lfs_file_isshared(lfs_t *lfs, lfs_file_t *file);
+
 
 /// Directory operations ///
 
@@ -646,6 +978,45 @@ lfs_soff_t lfs_dir_tell(lfs_t *lfs, lfs_dir_t *dir);
 int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir);
 
 
+/// Transaction operations ///
+
+#ifndef LFS_READONLY
+// Begin a transaction
+//
+// Until the transaction is committed, syncing or closing a file writes out
+// its data but holds back the update to its metadata. lfs_txn_commit then
+// writes the held updates in a single metadata commit, so either all of
+// them or none of them survive a power-loss.
+//
+// Only files in the same metadata pair as the first file synced are
+// batched, files elsewhere are committed immediately as usual. Any other
+// operation that modifies that metadata pair, such as creating, removing or
+// renaming a file in it, commits the transaction so far first. Until the
+// transaction is committed, opening a file with a held update finds its
+// old contents.
+//
+// Only one transaction may be in progress at a time, and it must be
+// committed before unmounting. The config struct must be zeroed for
+// defaults and backwards compatibility.
+//
+// Returns a negative error code on failure.
+int lfs_txn_begin(lfs_t *lfs, lfs_txn_t *txn,
+        const struct lfs_txn_config *config);
+#endif
+
+#ifndef LFS_READONLY
+// Commit a transaction
+//
+// Writes out every held metadata update and ends the transaction.
+//
+// If a file sync doesn't fit in the transaction buffer, the sync fails with
+// LFS_ERR_NOMEM and the transaction is left as it was.
+//
+// Returns a negative error code on failure.
+int lfs_txn_commit(lfs_t *lfs, lfs_txn_t *txn);
+#endif
+
+
 /// Filesystem-level filesystem operations
 
 // Finds the current size of the filesystem
@@ -656,6 +1027,18 @@ int lfs_dir_rewind(lfs_t *lfs, lfs_dir_t *dir);
 // Returns the number of allocated blocks, or a negative error code on failure.
 lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 
+// Finds the number of blocks in use by the filesystem without traversing it
+// if possible
+//
+// If the lookahead buffer covers the whole device the count is taken when
+// mounting and kept up to date as blocks are allocated and released,
+// otherwise this traverses the filesystem like lfs_fs_size. Blocks dropped
+// without being released, such as those of a write that failed, are
+// counted until the allocator next scans the whole device.
+//
+// Returns the number of allocated blocks, or a negative error code on failure.
+lfs_ssize_t lfs_fs_usage(lfs_t *lfs);
+
 // Traverse through all blocks in use by the filesystem
 //
 // The provided callback will be called with each block address that is
@@ -665,6 +1048,56 @@ lfs_ssize_t lfs_fs_size(lfs_t *lfs);
 // Returns a negative error code on failure.
 int lfs_fs_traverse(lfs_t *lfs, int (*cb)(void*, lfs_block_t), void *data);
 
+#ifndef LFS_READONLY
+// Writes a checkpoint of the mount state to the superblock
+//
+// Lets the next mount with the checkpoint option skip scanning the metadata
+// pairs, as long as nothing is written before then. With the checkpoint
+// option this is done by unmount, this is for systems that lose power
+// without unmounting. Does nothing if the checkpoint is already current.
+// While the checkpoint is there the superblock carries a newer minor disk
+// version, so drivers that don't support checkpoints refuse to mount.
+//
+// Returns a negative error code on failure, LFS_ERR_NOSPC if there are too
+// many metadata pairs to list in the superblock.
+int lfs_fs_checkpoint(lfs_t *lfs);
+#endif
+
+#ifndef LFS_READONLY
+// Erases a free block ahead of the allocator
+//
+// Erases the next free block the allocator will hand out, unless the
+// erase_pool_count blocks erased ahead of time haven't been used yet.
+// Erases at most one block per call, so this can run in between other
+// operations during idle time. Traverses the filesystem if the allocator
+// has run out of known free blocks, as the next allocation would.
+//
+// Returns 1 if a block was erased, 0 if there was nothing to do, or a
+// negative error code on failure.
+int lfs_fs_preerase(lfs_t *lfs);
+#endif
+
+#ifndef LFS_READONLY
+// Synchronize every open file on storage
+//
+// Commits everything written to open files, including syncs held back by
+// lfs_file_lazysync. Files synced as part of a transaction still wait for
+// lfs_txn_commit.
+//
+// Returns a negative error code on failure.
+int lfs_fs_sync(lfs_t *lfs);
+#endif
+
+#ifndef LFS_READONLY
+// Commit the syncs held back by lfs_file_lazysync
+//
+// Unlike lfs_fs_sync, files that were written but never synced are left
+// alone.
+//
+// Returns a negative error code on failure.
+int lfs_fs_syncheld(lfs_t *lfs);
+#endif
+
 #ifndef LFS_READONLY
 #ifdef LFS_MIGRATE
 // Attempts to migrate a previous version of littlefs
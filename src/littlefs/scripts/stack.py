@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+
+# This script finds the worst-case stack usage of each function from the
+# call graphs gcc writes with -fcallgraph-info=su. Calls through function
+# pointers can't be followed, they are counted as the worst of the functions
+# given with -i, or as free and marked in the report if there are none,
+# recursion is reported as unbounded.
+#
+# example:
+# $ make stack
+# $ ./scripts/stack.py *.ci -f lfs_dir_commit -l 1024 -i 'lfs_bd_*:lfs_testbd_*'
+
+import re
+import sys
+import fnmatch
+import argparse
+import collections
+
+NODE_PATTERN = re.compile(
+    r'node:\s*{\s*title:\s*"(?P<title>[^"]*)"\s*'
+    r'label:\s*"(?P<name>[^\\"]*)\\n[^"]*?(?P<frame>[0-9]+) bytes')
+INDIRECT = '__indirect_call'
+EDGE_PATTERN = re.compile(
+    r'edge:\s*{\s*sourcename:\s*"(?P<source>[^"]*)"\s*'
+    r'targetname:\s*"(?P<target>[^"]*)"')
+
+def collect(paths):
+    names = {}
+    frames = {}
+    calls = collections.defaultdict(set)
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                m = NODE_PATTERN.search(line)
+                if m:
+                    # clones keep the name of the function they came from
+                    names[m.group('title')] = m.group('name').split('.')[0]
+                    frames[m.group('title')] = int(m.group('frame'))
+                    continue
+
+                m = EDGE_PATTERN.search(line)
+                if m:
+                    calls[m.group('source')].add(m.group('target'))
+
+    # calls to functions defined in other files are by name only
+    byname = {name: title for title, name in names.items()}
+    for source, targets in calls.items():
+        calls[source] = {
+            byname.get(target, target) for target in targets}
+
+    return names, frames, calls
+
+def limits(frames, calls, indirect):
+    results = {}
+    def limit(title, path, crossed):
+        # path maps each function on the path to the number of indirect
+        # calls made before it, coming back to a function through an
+        # indirect call is taken to be a different callback, not recursion,
+        # this depends on the path so these results aren't kept
+        if title in path:
+            if crossed > path[title]:
+                return 0, False
+            return float('inf'), True
+        if title in results:
+            return results[title], True
+
+        path[title] = crossed
+        exact = True
+        worst = 0
+        for target in calls[title]:
+            if target == INDIRECT:
+                targets = [(t, crossed+1) for t in indirect.get(title, [])]
+            else:
+                targets = [(target, crossed)]
+
+            for target_, crossed_ in targets:
+                target_limit, target_exact = limit(target_, path, crossed_)
+                worst = max(worst, target_limit)
+                exact = exact and target_exact
+        del path[title]
+
+        if exact:
+            results[title] = frames.get(title, 0) + worst
+        return frames.get(title, 0) + worst, exact
+
+    return {title: limit(title, {}, 0)[0] for title in frames}
+
+def partials(calls, indirect):
+    # functions whose limit leaves out calls through function pointers
+    # because we weren't told where they go
+    results = {}
+    def reaches(title, path):
+        if title in path:
+            return False
+        if title in results:
+            return results[title]
+
+        path.add(title)
+        result = any(
+            not indirect.get(title) if target == INDIRECT
+                else reaches(target, path)
+            for target in calls[title])
+        path.remove(title)
+
+        results[title] = result
+        return result
+
+    return {title for title in list(calls) if reaches(title, set())}
+
+def main(**args):
+    names, frames, calls = collect(args['ci_paths'])
+
+    # where do indirect calls go? either from anywhere or only from
+    # callers matching the part before a colon
+    indirect = collections.defaultdict(list)
+    for spec in args.get('indirect') or []:
+        caller, _, pattern = spec.rpartition(':')
+        targets = [title for title in frames
+            if fnmatch.fnmatchcase(names[title], pattern)]
+        if not targets:
+            print("error: no function matches %s" % pattern,
+                file=sys.stderr)
+            sys.exit(-1)
+
+        for title in frames:
+            if INDIRECT in calls[title] and (not caller or
+                    fnmatch.fnmatchcase(names[title], caller)):
+                indirect[title].extend(targets)
+
+    results = limits(frames, calls, indirect)
+    partial = partials(calls, indirect)
+
+    titles = sorted(frames, key=lambda t: names[t])
+    if args.get('functions'):
+        missing = set(args['functions']) - set(names.values())
+        if missing:
+            print("error: no function %s" % ', '.join(sorted(missing)),
+                file=sys.stderr)
+            sys.exit(-1)
+        titles = [t for t in titles if names[t] in args['functions']]
+
+    print('%-36s %7s %7s' % ('function', 'frame', 'limit'))
+    for title in titles:
+        print('%-36s %7d %7s%s' % (names[title], frames[title],
+            '%d' % results[title] if results[title] != float('inf')
+                else 'inf',
+            '*' if title in partial else ''))
+
+    worst = max((results[t] for t in titles), default=0)
+    print('%-36s %7s %7s%s' % ('TOTAL', '',
+        '%d' % worst if worst != float('inf') else 'inf',
+        '*' if any(t in partial for t in titles) else ''))
+    if any(t in partial for t in titles):
+        print("* excludes calls through function pointers, see -i")
+
+    if args.get('limit') is not None and worst > args['limit']:
+        print("error: stack limit of %d bytes exceeded" % args['limit'],
+            file=sys.stderr)
+        sys.exit(-1)
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Find worst-case stack usage from gcc call graphs.")
+    parser.add_argument('ci_paths', nargs='+',
+        help="Call graph files generated by gcc with -fcallgraph-info=su.")
+    parser.add_argument('-f', '--function', dest='functions',
+        action='append',
+        help="Only report these functions. May be given multiple times.")
+    parser.add_argument('-i', '--indirect', action='append',
+        help="Functions calls through function pointers may reach, count "
+            "these calls as the worst of them. Prefix with caller: to only "
+            "apply to calls made by matching functions. Accepts "
+            "shell-style patterns, may be given multiple times.")
+    parser.add_argument('-l', '--limit', type=int,
+        help="Fail if the worst-case stack usage of the reported functions "
+            "exceeds this many bytes, or is unbounded.")
+    main(**vars(parser.parse_args()))
@@ -50,6 +50,22 @@ DEFINES = {
     'LFS_BLOCK_CYCLES': -1,
     'LFS_CACHE_SIZE': '(64 % LFS_PROG_SIZE == 0 ? 64 : LFS_PROG_SIZE)',
     'LFS_LOOKAHEAD_SIZE': 16,
+    'LFS_RCACHE_COUNT': 0,
+    'LFS_RCACHE_WAYS': 0,
+    'LFS_DCACHE_COUNT': 0,
+    'LFS_CTZ_CACHE_COUNT': 0,
+    'LFS_READAHEAD_COUNT': 0,
+    'LFS_FILTER_SIZE': 0,
+    'LFS_DINDEX_COUNT': 0,
+    'LFS_CHECKPOINT': 0,
+    'LFS_MCACHE_COUNT': 0,
+    'LFS_VCACHE_COUNT': 0,
+    'LFS_DIR_CACHES': 0,
+    'LFS_ERASE_ASYNC': 0,
+    'LFS_ERASE_READS': 0,
+    'LFS_ERASE_POOL_COUNT': 0,
+    'LFS_READV': 0,
+    'LFS_SYNC_SIZE': 0,
     'LFS_ERASE_VALUE': 0xff,
     'LFS_ERASE_CYCLES': 0,
     'LFS_BADBLOCK_BEHAVIOR': 'LFS_TESTBD_BADBLOCK_PROGERROR',
@@ -72,6 +88,10 @@ PROLOGUE = """
         .prog           = lfs_testbd_prog,
         .erase          = lfs_testbd_erase,
         .sync           = lfs_testbd_sync,
+        .erase_async    = LFS_ERASE_ASYNC ? lfs_testbd_erase_async : NULL,
+        .wait           = LFS_ERASE_ASYNC ? lfs_testbd_wait : NULL,
+        .erase_reads    = LFS_ERASE_READS,
+        .readv          = LFS_READV ? lfs_testbd_readv : NULL,
         .read_size      = LFS_READ_SIZE,
         .prog_size      = LFS_PROG_SIZE,
         .block_size     = LFS_BLOCK_SIZE,
@@ -79,6 +99,19 @@ PROLOGUE = """
         .block_cycles   = LFS_BLOCK_CYCLES,
         .cache_size     = LFS_CACHE_SIZE,
         .lookahead_size = LFS_LOOKAHEAD_SIZE,
+        .rcache_count   = LFS_RCACHE_COUNT,
+        .rcache_ways    = LFS_RCACHE_WAYS,
+        .dcache_count   = LFS_DCACHE_COUNT,
+        .ctz_cache_count = LFS_CTZ_CACHE_COUNT,
+        .readahead_count = LFS_READAHEAD_COUNT,
+        .filter_size    = LFS_FILTER_SIZE,
+        .dindex_count   = LFS_DINDEX_COUNT,
+        .checkpoint     = LFS_CHECKPOINT,
+        .mcache_count   = LFS_MCACHE_COUNT,
+        .vcache_count   = LFS_VCACHE_COUNT,
+        .dir_caches     = LFS_DIR_CACHES,
+        .erase_pool_count = LFS_ERASE_POOL_COUNT,
+        .sync_size      = LFS_SYNC_SIZE,
     };
 
     __attribute__((unused)) const struct lfs_testbd_config bdcfg = {
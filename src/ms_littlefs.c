@@ -27,8 +27,21 @@
 typedef struct {
     lfs_t           lfs;
     ms_handle_t     lockid;
+    ms_handle_t     rlockid;
+    ms_handle_t     semcid;
+    ms_handle_t     clockid;
+    ms_uint32_t     readers;
+    ms_handle_t     worker_exitid;
+    ms_bool_t       worker_run;
+    volatile ms_bool_t worker_quit;
+    int             sync_err;
 } ms_lfs_t;
 
+typedef struct {
+    lfs_file_t      file;
+    ms_handle_t     lockid;
+} ms_lfs_file_t;
+
 static int __ms_littlefs_err_to_errno(int err)
 {
     switch (err) {
@@ -202,15 +215,234 @@ static ms_uint8_t __ms_littlefs_file_type_to_type(ms_uint8_t type)
     return ret;
 }
 
+static ms_err_t __ms_little_fs_lock_create(ms_lfs_t *lfs)
+{
+    ms_err_t err;
+
+    err = ms_mutex_create("lfs_lock", MS_WAIT_TYPE_PRIO, &lfs->lockid);
+    if (err == MS_ERR_NONE) {
+        err = ms_mutex_create("lfs_rlock", MS_WAIT_TYPE_PRIO, &lfs->rlockid);
+        if (err == MS_ERR_NONE) {
+            err = ms_semc_create("lfs_semc", 1U, 1U, MS_WAIT_TYPE_PRIO, &lfs->semcid);
+            if (err == MS_ERR_NONE) {
+                err = ms_mutex_create("lfs_clock", MS_WAIT_TYPE_PRIO, &lfs->clockid);
+                if (err == MS_ERR_NONE) {
+                    lfs->readers = 0U;
+                    return MS_ERR_NONE;
+                }
+                (void)ms_semc_destroy(lfs->semcid);
+            }
+            (void)ms_mutex_destroy(lfs->rlockid);
+        }
+        (void)ms_mutex_destroy(lfs->lockid);
+    }
+
+    return err;
+}
+
+static void __ms_little_fs_lock_destroy(ms_lfs_t *lfs)
+{
+    (void)ms_mutex_destroy(lfs->clockid);
+    (void)ms_semc_destroy(lfs->semcid);
+    (void)ms_mutex_destroy(lfs->rlockid);
+    (void)ms_mutex_destroy(lfs->lockid);
+}
+
+/*
+ * Exclusive lock, for everything that may modify the file system.
+ * Writers keep lockid while they wait for the readers to drain, so readers
+ * that arrive later queue up behind them instead of starving them.
+ */
 static void __ms_little_fs_lock(ms_lfs_t *lfs)
 {
     while (ms_mutex_lock(lfs->lockid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
     }
+
+    while (ms_semc_wait(lfs->semcid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+    }
 }
 
 static void __ms_little_fs_unlock(ms_lfs_t *lfs)
 {
+    (void)ms_semc_post(lfs->semcid);
+    (void)ms_mutex_unlock(lfs->lockid);
+}
+
+/*
+ * Shared lock, for operations that only read the file system.
+ * The first reader in takes semcid on behalf of all readers, the last one out
+ * gives it back.
+ */
+static void __ms_little_fs_rdlock(ms_lfs_t *lfs)
+{
+    while (ms_mutex_lock(lfs->lockid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+    }
     (void)ms_mutex_unlock(lfs->lockid);
+
+    while (ms_mutex_lock(lfs->rlockid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+    }
+
+    if (lfs->readers++ == 0U) {
+        while (ms_semc_wait(lfs->semcid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+        }
+    }
+
+    (void)ms_mutex_unlock(lfs->rlockid);
+}
+
+static void __ms_little_fs_rdunlock(ms_lfs_t *lfs)
+{
+    while (ms_mutex_lock(lfs->rlockid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+    }
+
+    if (--lfs->readers == 0U) {
+        (void)ms_semc_post(lfs->semcid);
+    }
+
+    (void)ms_mutex_unlock(lfs->rlockid);
+}
+
+/*
+ * Shared lock plus the caches littlefs shares between reads of metadata,
+ * for path lookups, directory reads and file system usage.
+ */
+static void __ms_little_fs_cache_lock(ms_lfs_t *lfs)
+{
+    __ms_little_fs_rdlock(lfs);
+
+    while (ms_mutex_lock(lfs->clockid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+    }
+}
+
+static void __ms_little_fs_cache_unlock(ms_lfs_t *lfs)
+{
+    (void)ms_mutex_unlock(lfs->clockid);
+
+    __ms_little_fs_rdunlock(lfs);
+}
+
+/*
+ * Lock for an operation on an open file that doesn't modify the file system.
+ * Files littlefs can read on their own only need the shared lock and their
+ * own lock, others need the file system to themselves.
+ * Returns MS_TRUE if the shared lock was taken.
+ */
+static ms_bool_t __ms_little_fs_file_lock(ms_lfs_t *lfs, ms_lfs_file_t *lfs_file)
+{
+    __ms_little_fs_rdlock(lfs);
+
+    if (lfs_file_isshared(&lfs->lfs, &lfs_file->file)) {
+        while (ms_mutex_lock(lfs_file->lockid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+        }
+        return MS_TRUE;
+    }
+
+    __ms_little_fs_rdunlock(lfs);
+    __ms_little_fs_lock(lfs);
+    return MS_FALSE;
+}
+
+static void __ms_little_fs_file_unlock(ms_lfs_t *lfs, ms_lfs_file_t *lfs_file, ms_bool_t shared)
+{
+    if (shared) {
+        (void)ms_mutex_unlock(lfs_file->lockid);
+        __ms_little_fs_rdunlock(lfs);
+    } else {
+        __ms_little_fs_unlock(lfs);
+    }
+}
+
+/*
+ * Background worker, keeps the pool of pre-erased blocks topped up while the
+ * file system is idle, so writes don't have to wait for an erase, and commits
+ * the syncs held back by fdatasync() at least every MS_LITTLEFS_SYNC_PERIOD.
+ * A failed commit is latched and reported by the next fsync(), fdatasync()
+ * or sync().
+ */
+static void __ms_littlefs_worker(ms_ptr_t arg)
+{
+    ms_lfs_t *lfs = arg;
+    const struct lfs_config *cfg = lfs->lfs.cfg;
+    ms_uint32_t idle = 0U;
+    int ret;
+
+    while (!lfs->worker_quit) {
+        ret = 0;
+
+        __ms_little_fs_lock(lfs);
+        if (cfg->erase_pool_count != 0U) {
+            ret = lfs_fs_preerase(&lfs->lfs);
+        }
+        if ((cfg->sync_size != 0U) && (idle >= MS_LITTLEFS_SYNC_PERIOD)) {
+            int err = lfs_fs_syncheld(&lfs->lfs);
+            if ((err < 0) && (lfs->sync_err == 0)) {
+                lfs->sync_err = err;
+            }
+            idle = 0U;
+        }
+        __ms_little_fs_unlock(lfs);
+
+        if (ret <= 0) {
+            /*
+             * Pool full, no free blocks or an error, try again later
+             */
+            (void)ms_thread_sleep_ms(MS_LITTLEFS_WORKER_PERIOD);
+            idle += MS_LITTLEFS_WORKER_PERIOD;
+        }
+    }
+
+    (void)ms_semc_post(lfs->worker_exitid);
+}
+
+static ms_err_t __ms_littlefs_worker_start(ms_lfs_t *lfs, const struct lfs_config *cfg)
+{
+    ms_handle_t tid;
+    ms_err_t err;
+
+    lfs->worker_run = MS_FALSE;
+    if ((cfg->erase_pool_count == 0U) && (cfg->sync_size == 0U)) {
+        return MS_ERR_NONE;
+    }
+
+    err = ms_semc_create("lfs_worker", 0U, 1U, MS_WAIT_TYPE_PRIO, &lfs->worker_exitid);
+    if (err == MS_ERR_NONE) {
+        lfs->worker_quit = MS_FALSE;
+        err = ms_thread_create("t_lfs_worker", __ms_littlefs_worker, lfs,
+                               MS_LITTLEFS_WORKER_STK_SIZE, MS_LITTLEFS_WORKER_PRIO,
+                               0U, MS_THREAD_OPT_SUPER, &tid);
+        if (err == MS_ERR_NONE) {
+            lfs->worker_run = MS_TRUE;
+        } else {
+            (void)ms_semc_destroy(lfs->worker_exitid);
+        }
+    }
+
+    return err;
+}
+
+static void __ms_littlefs_worker_stop(ms_lfs_t *lfs)
+{
+    if (lfs->worker_run) {
+        lfs->worker_quit = MS_TRUE;
+        while (ms_semc_wait(lfs->worker_exitid, MS_TIMEOUT_FOREVER) != MS_ERR_NONE) {
+        }
+        (void)ms_semc_destroy(lfs->worker_exitid);
+        lfs->worker_run = MS_FALSE;
+    }
+}
+
+/*
+ * Report an error the worker ran into committing held syncs in place of a
+ * successful result, once, must be called with the file system locked
+ */
+static int __ms_littlefs_sync_err(ms_lfs_t *lfs, int ret)
+{
+    if ((ret >= 0) && (lfs->sync_err < 0)) {
+        ret = lfs->sync_err;
+    }
+    lfs->sync_err = 0;
+
+    return ret;
 }
 
 static int __ms_littlefs_mount(ms_io_mnt_t *mnt, ms_io_device_t *dev, const char *dev_name, ms_const_ptr_t param)
@@ -222,7 +454,7 @@ static int __ms_littlefs_mount(ms_io_mnt_t *mnt, ms_io_device_t *dev, const char
         lfs = ms_kzalloc(sizeof(ms_lfs_t));
         if (lfs != MS_NULL) {
 
-            if (ms_mutex_create("lfs_lock", MS_WAIT_TYPE_PRIO, &lfs->lockid) == MS_ERR_NONE) {
+            if (__ms_little_fs_lock_create(lfs) == MS_ERR_NONE) {
 
                 ret = lfs_mount(&lfs->lfs, dev->ctx);
                 if (ret < 0) {
@@ -233,8 +465,13 @@ static int __ms_littlefs_mount(ms_io_mnt_t *mnt, ms_io_device_t *dev, const char
                     }
                 }
 
+                if ((ret == 0) && (__ms_littlefs_worker_start(lfs, dev->ctx) != MS_ERR_NONE)) {
+                    (void)lfs_unmount(&lfs->lfs);
+                    ret = LFS_ERR_NOMEM;
+                }
+
                 if (ret < 0) {
-                    (void)ms_mutex_destroy(lfs->lockid);
+                    __ms_little_fs_lock_destroy(lfs);
                     ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
                     ret = -1;
 
@@ -270,6 +507,11 @@ static int __ms_littlefs_mkfs(ms_io_mnt_t *mnt, ms_const_ptr_t param)
     ms_lfs_t *lfs = mnt->ctx;
     int ret;
 
+    /*
+     * The worker must not touch the file system while it is torn down
+     */
+    __ms_littlefs_worker_stop(lfs);
+
     __ms_little_fs_lock(lfs);
 
     ret = lfs_unmount(&lfs->lfs);
@@ -278,6 +520,17 @@ static int __ms_littlefs_mkfs(ms_io_mnt_t *mnt, ms_const_ptr_t param)
         if (ret == 0) {
             ret = lfs_mount(&lfs->lfs, mnt->dev->ctx);
         }
+        lfs->sync_err = 0;
+
+        if ((ret == 0) && (__ms_littlefs_worker_start(lfs, mnt->dev->ctx) != MS_ERR_NONE)) {
+            ret = LFS_ERR_NOMEM;
+        }
+
+    } else {
+        /*
+         * Still mounted, keep the worker going
+         */
+        (void)__ms_littlefs_worker_start(lfs, mnt->dev->ctx);
     }
 
     __ms_little_fs_unlock(lfs);
@@ -297,15 +550,22 @@ static int __ms_littlefs_unmount(ms_io_mnt_t *mnt, ms_const_ptr_t param)
     ms_lfs_t *lfs = mnt->ctx;
     int ret;
 
+    __ms_littlefs_worker_stop(lfs);
+
     __ms_little_fs_lock(lfs);
     ret = lfs_unmount(&lfs->lfs);
     __ms_little_fs_unlock(lfs);
 
     if ((ret < 0) && !mnt->umount_req) {
+        /*
+         * Still mounted, keep the worker going
+         */
+        (void)__ms_littlefs_worker_start(lfs, mnt->dev->ctx);
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
         ret = -1;
     } else {
         mnt->ctx = MS_NULL;
+        __ms_little_fs_lock_destroy(lfs);
         (void)ms_kfree(lfs);
         ret = 0;
     }
@@ -316,20 +576,22 @@ static int __ms_littlefs_unmount(ms_io_mnt_t *mnt, ms_const_ptr_t param)
 static int __ms_littlefs_open(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *path, int oflag, ms_mode_t mode)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file;
+    ms_lfs_file_t *lfs_file;
     int ret;
 
     (void)mode;
 
-    lfs_file = ms_kzalloc(sizeof(lfs_file_t));
-    if (lfs_file != MS_NULL) {
+    lfs_file = ms_kzalloc(sizeof(ms_lfs_file_t));
+    if ((lfs_file != MS_NULL) &&
+        (ms_mutex_create("lfs_flock", MS_WAIT_TYPE_PRIO, &lfs_file->lockid) == MS_ERR_NONE)) {
         oflag = __ms_oflag_to_littlefs_oflag(oflag);
 
         __ms_little_fs_lock(lfs);
-        ret = lfs_file_open(&lfs->lfs, lfs_file, path, oflag);
+        ret = lfs_file_open(&lfs->lfs, &lfs_file->file, path, oflag);
         __ms_little_fs_unlock(lfs);
 
         if (ret < 0) {
+            (void)ms_mutex_destroy(lfs_file->lockid);
             (void)ms_kfree(lfs_file);
             ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
             ret = -1;
@@ -339,6 +601,9 @@ static int __ms_littlefs_open(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *
         }
 
     } else {
+        if (lfs_file != MS_NULL) {
+            (void)ms_kfree(lfs_file);
+        }
         ms_thread_set_errno(ENOMEM);
         ret = -1;
     }
@@ -349,17 +614,18 @@ static int __ms_littlefs_open(ms_io_mnt_t *mnt, ms_io_file_t *file, const char *
 static int __ms_littlefs_close(ms_io_mnt_t *mnt, ms_io_file_t *file)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file = file->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
     int ret;
 
     __ms_little_fs_lock(lfs);
-    ret = lfs_file_close(&lfs->lfs, lfs_file);
+    ret = lfs_file_close(&lfs->lfs, &lfs_file->file);
     __ms_little_fs_unlock(lfs);
 
     if ((ret < 0) && !mnt->umount_req) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
         ret = -1;
     } else {
+        (void)ms_mutex_destroy(lfs_file->lockid);
         (void)ms_kfree(lfs_file);
         file->ctx = MS_NULL;
         ret = 0;
@@ -371,12 +637,13 @@ static int __ms_littlefs_close(ms_io_mnt_t *mnt, ms_io_file_t *file)
 static ms_ssize_t __ms_littlefs_read(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_ptr_t buf, ms_size_t len)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file = file->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
+    ms_bool_t shared;
     ms_ssize_t ret;
 
-    __ms_little_fs_lock(lfs);
-    ret = lfs_file_read(&lfs->lfs, lfs_file, buf, len);
-    __ms_little_fs_unlock(lfs);
+    shared = __ms_little_fs_file_lock(lfs, lfs_file);
+    ret = lfs_file_read(&lfs->lfs, &lfs_file->file, buf, len);
+    __ms_little_fs_file_unlock(lfs, lfs_file, shared);
 
     if (ret < 0) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
@@ -389,11 +656,11 @@ static ms_ssize_t __ms_littlefs_read(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_pt
 static ms_ssize_t __ms_littlefs_write(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_const_ptr_t buf, ms_size_t len)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file = file->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
     ms_ssize_t ret;
 
     __ms_little_fs_lock(lfs);
-    ret = lfs_file_write(&lfs->lfs, lfs_file, buf, len);
+    ret = lfs_file_write(&lfs->lfs, &lfs_file->file, buf, len);
     __ms_little_fs_unlock(lfs);
 
     if (ret < 0) {
@@ -435,14 +702,15 @@ static int __ms_littlefs_fcntl(ms_io_mnt_t *mnt, ms_io_file_t *file, int cmd, in
 static int __ms_littlefs_fstat(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_stat_t *buf)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file = file->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
+    ms_bool_t shared;
     int ret;
 
     bzero(buf, sizeof(ms_stat_t));
 
-    __ms_little_fs_lock(lfs);
-    ret = lfs_file_size(&lfs->lfs, lfs_file);
-    __ms_little_fs_unlock(lfs);
+    shared = __ms_little_fs_file_lock(lfs, lfs_file);
+    ret = lfs_file_size(&lfs->lfs, &lfs_file->file);
+    __ms_little_fs_file_unlock(lfs, lfs_file, shared);
 
     if (ret < 0) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
@@ -464,11 +732,37 @@ static int __ms_littlefs_isatty(ms_io_mnt_t *mnt, ms_io_file_t *file)
 static int __ms_littlefs_fsync(ms_io_mnt_t *mnt, ms_io_file_t *file)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file = file->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
+    int ret;
+
+    __ms_little_fs_lock(lfs);
+    ret = lfs_file_sync(&lfs->lfs, &lfs_file->file);
+    ret = __ms_littlefs_sync_err(lfs, ret);
+    __ms_little_fs_unlock(lfs);
+
+    if (ret < 0) {
+        ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
+        ret = -1;
+    } else {
+        ret = 0;
+    }
+
+    return ret;
+}
+
+/*
+ * With the device's sync_size set, fdatasync() holds back syncs of fewer
+ * bytes, see MS_LITTLEFS_SYNC_PERIOD
+ */
+static int __ms_littlefs_fdatasync(ms_io_mnt_t *mnt, ms_io_file_t *file)
+{
+    ms_lfs_t *lfs = mnt->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
     int ret;
 
     __ms_little_fs_lock(lfs);
-    ret = lfs_file_sync(&lfs->lfs, lfs_file);
+    ret = lfs_file_lazysync(&lfs->lfs, &lfs_file->file);
+    ret = __ms_littlefs_sync_err(lfs, ret);
     __ms_little_fs_unlock(lfs);
 
     if (ret < 0) {
@@ -484,11 +778,11 @@ static int __ms_littlefs_fsync(ms_io_mnt_t *mnt, ms_io_file_t *file)
 static int __ms_littlefs_ftruncate(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_t len)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file = file->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
     int ret;
 
     __ms_little_fs_lock(lfs);
-    ret = lfs_file_truncate(&lfs->lfs, lfs_file, len);
+    ret = lfs_file_truncate(&lfs->lfs, &lfs_file->file, len);
     __ms_little_fs_unlock(lfs);
 
     if (ret < 0) {
@@ -504,14 +798,15 @@ static int __ms_littlefs_ftruncate(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_
 static ms_off_t __ms_littlefs_lseek(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_off_t offset, int whence)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file = file->ctx;
+    ms_lfs_file_t *lfs_file = file->ctx;
+    ms_bool_t shared;
     ms_off_t ret;
 
     whence = __ms_whence_to_littlefs_whence(whence);
 
-    __ms_little_fs_lock(lfs);
-    ret = lfs_file_seek(&lfs->lfs, lfs_file, offset, whence);
-    __ms_little_fs_unlock(lfs);
+    shared = __ms_little_fs_file_lock(lfs, lfs_file);
+    ret = lfs_file_seek(&lfs->lfs, &lfs_file->file, offset, whence);
+    __ms_little_fs_file_unlock(lfs, lfs_file, shared);
 
     if (ret < 0) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
@@ -533,9 +828,9 @@ static int __ms_littlefs_stat(ms_io_mnt_t *mnt, const char *path, ms_stat_t *buf
         path = "/";
     }
 
-    __ms_little_fs_lock(lfs);
+    __ms_little_fs_cache_lock(lfs);
     ret = lfs_stat(&lfs->lfs, path, &linfo);
-    __ms_little_fs_unlock(lfs);
+    __ms_little_fs_cache_unlock(lfs);
 
     if (ret < 0) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
@@ -557,9 +852,9 @@ static int __ms_littlefs_statvfs(ms_io_mnt_t *mnt, ms_statvfs_t *buf)
     lfs_ssize_t fs_size;
     int ret;
 
-    __ms_little_fs_lock(lfs);
-    fs_size = lfs_fs_size(&lfs->lfs);
-    __ms_little_fs_unlock(lfs);
+    __ms_little_fs_cache_lock(lfs);
+    fs_size = lfs_fs_usage(&lfs->lfs);
+    __ms_little_fs_cache_unlock(lfs);
 
     if (fs_size < 0) {
         bzero(buf, sizeof(ms_statvfs_t));
@@ -645,22 +940,11 @@ static int __ms_littlefs_rename(ms_io_mnt_t *mnt, const char *old, const char *_
 static int __ms_littlefs_sync(ms_io_mnt_t *mnt)
 {
     ms_lfs_t *lfs = mnt->ctx;
-    lfs_file_t *lfs_file;
-    int ret = 0;
+    int ret;
 
     __ms_little_fs_lock(lfs);
-
-    for (lfs_file = (lfs_file_t *)lfs->lfs.mlist; lfs_file != MS_NULL; lfs_file = lfs_file->next) {
-        if ((lfs_file->type & LFS_TYPE_MASK) != LFS_TYPE_REG) {
-            continue;
-        }
-
-        ret = lfs_file_sync(&lfs->lfs, lfs_file);
-        if (ret < 0) {
-            break;
-        }
-    }
-
+    ret = lfs_fs_sync(&lfs->lfs);
+    ret = __ms_littlefs_sync_err(lfs, ret);
     __ms_little_fs_unlock(lfs);
 
     if (ret < 0) {
@@ -764,9 +1048,9 @@ static int __ms_littlefs_readdir_r(ms_io_mnt_t *mnt, ms_io_file_t *file, ms_dire
     struct lfs_info linfo;
     int ret;
 
-    __ms_little_fs_lock(lfs);
+    __ms_little_fs_cache_lock(lfs);
     ret = lfs_dir_read(&lfs->lfs, lfs_dir, &linfo);
-    __ms_little_fs_unlock(lfs);
+    __ms_little_fs_cache_unlock(lfs);
 
     if (ret > 0) {
         strlcpy(entry->d_name, linfo.name, sizeof(entry->d_name));
@@ -801,9 +1085,9 @@ static int __ms_littlefs_rewinddir(ms_io_mnt_t *mnt, ms_io_file_t *file)
     lfs_dir_t *lfs_dir = file->ctx;
     int ret;
 
-    __ms_little_fs_lock(lfs);
+    __ms_little_fs_cache_lock(lfs);
     ret = lfs_dir_rewind(&lfs->lfs, lfs_dir);
-    __ms_little_fs_unlock(lfs);
+    __ms_little_fs_cache_unlock(lfs);
 
     if (ret < 0) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
@@ -821,9 +1105,9 @@ static int __ms_littlefs_seekdir(ms_io_mnt_t *mnt, ms_io_file_t *file, long loc)
     lfs_dir_t *lfs_dir = file->ctx;
     int ret;
 
-    __ms_little_fs_lock(lfs);
+    __ms_little_fs_cache_lock(lfs);
     ret = lfs_dir_seek(&lfs->lfs, lfs_dir, loc);
-    __ms_little_fs_unlock(lfs);
+    __ms_little_fs_cache_unlock(lfs);
 
     if (ret < 0) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
@@ -841,9 +1125,9 @@ static long __ms_littlefs_telldir(ms_io_mnt_t *mnt, ms_io_file_t *file)
     lfs_dir_t *lfs_dir = file->ctx;
     long ret;
 
-    __ms_little_fs_lock(lfs);
+    __ms_little_fs_cache_lock(lfs);
     ret = lfs_dir_tell(&lfs->lfs, lfs_dir);
-    __ms_little_fs_unlock(lfs);
+    __ms_little_fs_cache_unlock(lfs);
 
     if (ret < 0) {
         ms_thread_set_errno(__ms_littlefs_err_to_errno(ret));
@@ -879,7 +1163,7 @@ static ms_io_fs_ops_t ms_io_littlefs_ops = {
         .fstat      = __ms_littlefs_fstat,
         .isatty     = __ms_littlefs_isatty,
         .fsync      = __ms_littlefs_fsync,
-        .fdatasync  = __ms_littlefs_fsync,
+        .fdatasync  = __ms_littlefs_fdatasync,
         .ftruncate  = __ms_littlefs_ftruncate,
         .lseek      = __ms_littlefs_lseek,
         .poll       = MS_NULL,
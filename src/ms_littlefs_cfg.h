@@ -48,4 +48,47 @@
 
 #undef  LFS_NO_MALLOC
 
+/*
+ * Use slice-by-8 tables for lfs_crc instead of the default nibble table.
+ * Costs 8 KiB of read-only data but processes a word at a time, which
+ * speeds up mount, directory fetch and metadata commits. Off unless defined
+ * here or on the compiler's command line.
+ */
+/* #define LFS_CRC_SLICE8 */
+
+/*
+ * Background worker thread, only started for devices whose lfs_config sets
+ * erase_pool_count or sync_size. It wakes every MS_LITTLEFS_WORKER_PERIOD
+ * milliseconds once the pool is full and erases blocks while the file system
+ * is idle.
+ *
+ * On devices that set sync_size, fdatasync() uses lfs_file_lazysync: a sync
+ * of fewer than sync_size bytes written since the last commit is held back
+ * and is not on storage when fdatasync() returns. The worker commits held
+ * syncs every MS_LITTLEFS_SYNC_PERIOD milliseconds, fsync(), sync() and
+ * close() commit them right away. An error the worker runs into committing
+ * them is returned by the next fsync(), fdatasync() or sync().
+ *
+ * The worker's deepest path is lfs_fs_syncheld committing a file, through
+ * lfs_dir_commit, lfs_dir_compact, lfs_dir_traverse and the commit
+ * callbacks. A metadata pair relocation recurses into lfs_dir_commit, so
+ * scripts/stack.py reports the path as unbounded and the stack size is an
+ * estimate with margin, not a proven bound. In littlefs/, on x86-64 with
+ * -Os, running
+ *
+ *   make stack SFLAGS+="-f lfs_dir_traverse -f lfs_dir_compact
+ *       -f lfs_dir_commit -f lfs_file_rawsync -f lfs_fs_rawsync
+ *       -f lfs_fs_syncheld -i 'lfs_dir_traverse:lfs_dir_commit_*'
+ *       -i 'lfs_bd_*:lfs_testbd_*'"
+ *
+ * bounds lfs_dir_traverse, including the commit callbacks and the test
+ * block device, at 1088 bytes, and lists frames of 736 bytes for the five
+ * functions above it, about 1.8 KiB for one pass. The rest is for the real
+ * block device driver, the target's frame sizes and one relocation.
+ */
+#define MS_LITTLEFS_WORKER_STK_SIZE     4096U
+#define MS_LITTLEFS_WORKER_PRIO         30U
+#define MS_LITTLEFS_WORKER_PERIOD       100U
+#define MS_LITTLEFS_SYNC_PERIOD         1000U
+
 #endif /* MS_LITTLEFS_CFG_H */